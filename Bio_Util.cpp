@@ -7,268 +7,5055 @@
  *              It will take in a path to a fasta file.  It will then provide the 
  *              genome count for A, T, G, C, & N.
  *
- * Compile: g++ -Wall -O3 -std=c++14 -pthread -o bio-util Bio_Util.cpp
+ * Compile: g++ -Wall -O3 -std=c++17 -pthread -o bio-util Bio_Util.cpp -lz
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <zlib.h>  // Inflating gzip and BGZF input
+#include <errno.h>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <sstream>
+#include <charconv>  // Formatting integers with std::to_chars
 #include <iomanip>
 #include <exception>
+#include <stdexcept>
 #include <vector>
 #include <algorithm>
 #include <thread>
 #include <mutex>  // Lock guard
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>  // The k-mer histogram
+#include <functional>
+#include <memory>
+#include <filesystem>  // Walking directories of FASTA files
+#if defined(__x86_64__) || defined(__i386__)
+#define BIO_UTIL_X86
+#include <immintrin.h>  // SSE/AVX intrinsics for the counting kernels
+#endif
 
 using BigInt = uint64_t;  // Change here if experiencing overflow
 using ThrdVec = std::vector<std::thread>;
 using BigIVec = std::vector<BigInt>;
 
+// Every residue code that gets its own count.  G, C, A, T and N come first, 
+// in the order the vector kernels report them, then the IUPAC ambiguity codes.
+const char RESIDUES[] = "GCATNURYKMSWBDHV";
+const int NUM_RESIDUES = 16;
+const int NUM_BASES = 5;  // G, C, A, T & N
+
+// The bases of the dinucleotides, which are counted in this order: AA, AC, 
+// ... TT.  CG is the one CpG islands are called from.
+const char PAIR_BASES[] = "ACGT";
+const int CPG_PAIR = 1 * 4 + 2;
+
+/**
+ * This is a struct to hold the nucleotide counts of a genome, or of a piece 
+ * of one.  Upper case residues are kept apart from the lower case (soft 
+ * masked) ones.  Anything that is not a residue or a line ending is invalid.
+ */
+struct Counts {
+    BigInt upper[NUM_RESIDUES] = {};
+    BigInt lower[NUM_RESIDUES] = {};
+    BigInt invalid = 0;
+    BigInt newlines = 0;  // Not part of the stats, used to build the .fai
+    BigInt pairs[16] = {};  // Adjacent bases by 'PAIR_BASES', --dinucleotides
+
+    // Count of a residue in both cases, by its index in 'RESIDUES'
+    BigInt both(int r) const { return upper[r] + lower[r]; }
+
+    BigInt masked() const {
+        BigInt sum = 0;
+        for (int r = 0; r < NUM_RESIDUES; r++) sum += lower[r];
+        return sum;
+    }
+
+    BigInt total() const {
+        BigInt sum = 0;
+        for (int r = 0; r < NUM_RESIDUES; r++) sum += both(r);
+        return sum;
+    }
+
+    Counts& operator+=(const Counts& other) {
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            upper[r] += other.upper[r];
+            lower[r] += other.lower[r];
+        }
+        invalid += other.invalid;
+        newlines += other.newlines;
+        for (int p = 0; p < 16; p++) pairs[p] += other.pairs[p];
+        return *this;
+    }
+
+    bool operator==(const Counts& other) const {
+        return std::equal(upper, upper + NUM_RESIDUES, other.upper) && 
+               std::equal(lower, lower + NUM_RESIDUES, other.lower) && 
+               invalid == other.invalid && newlines == other.newlines && 
+               std::equal(pairs, pairs + 16, other.pairs);
+    }
+};  // End of the 'Counts' struct
+
+// A count for every byte value, filled in by 'histogramBytes'
+struct ByteHist {
+    BigInt count[256] = {};
+    BigInt& operator[](unsigned char byte) { return count[byte]; }
+    BigInt operator[](unsigned char byte) const { return count[byte]; }
+};  // End of the 'ByteHist' struct
+
+// Number of interleaved counter banks used by 'histogramBytes'
+const int HIST_BANKS = 4;
+
+// Signature shared by every nucleotide counting kernel
+using CountKernel = void (*)(const char* mem, BigInt len, Counts& counts);
+
+// Signature shared by every header scanning kernel
+using ScanKernel = void (*)(const char* mem, BigInt start, BigInt end, 
+                            BigIVec& found);
+
+// Signature shared by every packed 2-bit counting kernel
+using PackedKernel = void (*)(const unsigned char* dna, BigInt words, 
+                              BigInt* codes);
+
+// Signature shared by every dinucleotide counting kernel
+using PairKernel = void (*)(const char* mem, BigInt from, BigInt to, 
+                            BigInt limit, BigInt* pairs);
+
+/**
+ * This is a struct to carry the search for runs in a piece of a genome from 
+ * one block of bytes to the next.  The runs are of N for --gaps, and of lower 
+ * case for --soft-mask.
+ */
+struct RunScan {
+    BigInt base = 0;      // Bases walked so far, not counting line endings
+    bool inRun = false;   // True if the last base walked was in a run
+    BigIVec runs;         // Base each run starts at, then the one it ends at
+};  // End of the 'RunScan' struct
+
+// Signature shared by every run kernel
+using RunKernel = void (*)(const char* mem, BigInt from, BigInt to, 
+                           RunScan& scan);
+
+// Signature of the vector kernels driven by 'countChunks'
+const int CHUNK_LANES = 12;
+using ChunkKernel = void (*)(const char* mem, BigInt blocks, BigInt* lanes);
+
+/**
+ * This is a struct to track a batch of tasks submitted to the thread pool, 
+ * so the caller can wait for just that batch to finish.
+ */
+struct TaskGroup {
+    std::atomic<BigInt> pending{0};  // Tasks submitted but not finished yet
+};  // End of the 'TaskGroup' struct
+
+/**
+ * This is a thread pool that is created once and shared by every stage of 
+ * the program.  Each worker has its own deque of tasks.  A worker pushes and 
+ * pops tasks at the back of its own deque, and when that runs dry it steals 
+ * from the front of the others.  Tasks submitted from outside the pool are 
+ * dealt round robin over the deques.  Idle workers sleep until there is 
+ * something queued.
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * This is the constructor.  It will start the workers.
+     *
+     * @param threads The number of workers to start.
+     */
+    explicit ThreadPool(int threads) {
+        for (int t = 0; t < threads; t++) {
+            queues.emplace_back(new Queue);
+        }
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, t));
+        }
+    }  // End of the constructor
+
+    /**
+     * This is the destructor.  It will let the workers finish what is queued 
+     * and then join them.
+     */
+    ~ThreadPool() {
+        {  // Critical section
+        std::lock_guard<std::mutex> lock(sleepLock);
+        stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) {
+            t.join();
+        }
+    }  // End of the destructor
+
+    /**
+     * This is the function that will queue a task as part of a group.
+     *
+     * @param group The group the task belongs to.
+     * @param task The task to run.
+     */
+    void submit(TaskGroup& group, Task task) {
+        group.pending++;
+        int q = (workerIndex >= 0 && owner == this) ? workerIndex : 
+                static_cast<int>(nextQueue++ % queues.size());
+        {  // Critical section
+        std::lock_guard<std::mutex> lock(queues[q]->lock);
+        queues[q]->tasks.push_back(Entry{&group, std::move(task)});
+        }
+        queued++;
+        if (sleepers > 0) {
+            { std::lock_guard<std::mutex> lock(sleepLock); }
+            wake.notify_one();
+        }
+    }  // End of the 'submit' function
+
+    /**
+     * This is the function that will block until every task in a group is 
+     * done.  A worker that waits keeps running tasks in the meantime, so 
+     * tasks can safely wait on groups of their own.
+     *
+     * @param group The group to wait for.
+     */
+    void wait(TaskGroup& group) {
+        if (workerIndex >= 0 && owner == this) {
+            Entry entry;
+            while (group.pending > 0) {
+                if (popTask(workerIndex, entry)) {
+                    runTask(entry);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        } else {
+            std::unique_lock<std::mutex> lock(sleepLock);
+            done.wait(lock, [&group] { return group.pending == 0; });
+        }
+    }  // End of the 'wait' function
+
+    /**
+     * @returns The number of workers in the pool.
+     */
+    int size() const {
+        return static_cast<int>(workers.size());
+    }  // End of the 'size' function
+
+private:
+    struct Entry {
+        TaskGroup* group;
+        Task fn;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Entry> tasks;
+    };
+
+    /**
+     * This is a helper function that will take a task off the back of a 
+     * worker's own deque, or steal one off the front of another deque.
+     *
+     * @param self The index of the worker looking for a task.
+     * @param entry The task that was found.
+     * @returns True if a task was found.
+     */
+    bool popTask(int self, Entry& entry) {
+        int count = static_cast<int>(queues.size());
+        for (int i = 0; i < count; i++) {
+            Queue& q = *queues[(self + i) % count];
+            std::lock_guard<std::mutex> lock(q.lock);
+            if (!q.tasks.empty()) {
+                if (i == 0) {
+                    entry = std::move(q.tasks.back());
+                    q.tasks.pop_back();
+                } else {
+                    entry = std::move(q.tasks.front());
+                    q.tasks.pop_front();
+                }
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }  // End of the 'popTask' function
+
+    /**
+     * This is a helper function that will run a task and wake up anyone 
+     * waiting on its group if it was the last one.
+     *
+     * @param entry The task to run.
+     */
+    void runTask(Entry& entry) {
+        TaskGroup* group = entry.group;
+        entry.fn();
+        entry.fn = nullptr;
+        if (--group->pending == 0) {
+            { std::lock_guard<std::mutex> lock(sleepLock); }
+            done.notify_all();
+        }
+    }  // End of the 'runTask' function
+
+    /**
+     * This is the function for each worker to execute.  It runs tasks until 
+     * the pool is stopped and nothing is left queued.
+     *
+     * @param index The index of the worker.
+     */
+    void workerLoop(int index) {
+        workerIndex = index;
+        owner = this;
+        Entry entry;
+        while (true) {
+            if (popTask(index, entry)) {
+                runTask(entry);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepLock);
+            sleepers++;
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            sleepers--;
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }  // End of the 'workerLoop' function
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    ThrdVec workers;
+    std::atomic<BigInt> queued{0};      // Tasks sitting in the deques
+    std::atomic<int> sleepers{0};       // Workers waiting on 'wake'
+    std::atomic<unsigned> nextQueue{0}; // Round robin for outside submits
+    std::mutex sleepLock;
+    std::condition_variable wake;       // Signaled when a task is queued
+    std::condition_variable done;       // Signaled when a group finishes
+    bool stopping = false;
+    static thread_local int workerIndex;      // This thread's deque
+    static thread_local ThreadPool* owner;    // The pool this thread is in
+};  // End of the 'ThreadPool' class
+
+thread_local int ThreadPool::workerIndex = -1;
+thread_local ThreadPool* ThreadPool::owner = nullptr;
+
+/**
+ * This is the thread that does the writing for the output.  Full buffers are 
+ * queued to it and it writes each one with as few 'write' calls as it can, 
+ * so nobody counting ever waits on the disk.  Only 'OUTPUT_QUEUE' buffers 
+ * can be queued, after which 'submit' blocks until the disk catches up. 
+ * Written buffers are kept to be handed back out, so they aren't reallocated.
+ */
+class OutputThread {
+public:
+    /**
+     * This is the constructor.  It will start the thread.
+     *
+     * @param fd The file descriptor to write to.
+     */
+    explicit OutputThread(int fd) : fd(fd) {
+        writerThread = std::thread(&OutputThread::writeLoop, this);
+    }  // End of the constructor
+
+    /**
+     * This is the destructor.  It will write what is queued and stop the 
+     * thread, if 'finish' wasn't called.
+     */
+    ~OutputThread() {
+        finish();
+    }  // End of the destructor
+
+    /**
+     * This is the function that will queue a buffer to be written.
+     *
+     * @param buffer The buffer, which is left empty but with room in it.
+     */
+    void submit(std::string& buffer) {
+        std::unique_lock<std::mutex> lock(queueLock);
+        changed.wait(lock, [this] { return queued.size() < OUTPUT_QUEUE; });
+        queued.push_back(std::move(buffer));
+        if (!spare.empty()) {
+            buffer = std::move(spare.back());
+            spare.pop_back();
+        } else {
+            buffer = std::string();
+            buffer.reserve(OUTPUT_BUFFER);
+        }
+        changed.notify_all();
+    }  // End of the 'submit' function
+
+    /**
+     * This is the function that will wait for everything queued to be 
+     * written and then stop the thread.
+     *
+     * @returns False if a write failed.
+     */
+    bool finish() {
+        {  // Critical section
+        std::lock_guard<std::mutex> lock(queueLock);
+        stopping = true;
+        }
+        changed.notify_all();
+        if (writerThread.joinable()) {
+            writerThread.join();
+        }
+        return !error;
+    }  // End of the 'finish' function
+
+    static const BigInt OUTPUT_BUFFER = 1 << 20;  // Bytes in each buffer
+    static const BigInt OUTPUT_QUEUE = 8;         // Buffers that can be queued
+
+private:
+    /**
+     * This is the function for the thread to execute.
+     */
+    void writeLoop() {
+        while (true) {
+            std::string buffer;
+            {  // Critical section
+            std::unique_lock<std::mutex> lock(queueLock);
+            changed.wait(lock, [this] { return stopping || !queued.empty(); });
+            if (queued.empty()) {
+                return;
+            }
+            buffer = std::move(queued.front());
+            queued.pop_front();
+            }
+            changed.notify_all();
+            BigInt done = 0;
+            while (done < buffer.size() && !error) {
+                ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    error = true;
+                    break;
+                }
+                done += n;
+            }
+            buffer.clear();
+            {  // Critical section
+            std::lock_guard<std::mutex> lock(queueLock);
+            spare.push_back(std::move(buffer));
+            }
+        }
+    }  // End of the 'writeLoop' function
+
+    int fd;
+    std::deque<std::string> queued;  // Buffers waiting to be written
+    std::vector<std::string> spare;  // Written buffers to reuse
+    bool stopping = false;
+    std::atomic<bool> error{false};
+    std::mutex queueLock;
+    std::condition_variable changed;  // Signaled when 'queued' changes
+    std::thread writerThread;
+};  // End of the 'OutputThread' class
+
+/**
+ * This is the writer that puts the output in file order no matter what order 
+ * the genomes finish in.  Each genome reserves a sequence number, in file 
+ * order, before its tasks are queued.  When a genome's text is put, it is 
+ * written out along with any later ones that were waiting on it.  Only 
+ * 'window' genomes can be reserved past the oldest one that hasn't been 
+ * written yet, so the reorder buffer never holds more than that.  Text that 
+ * is in order is gathered into a buffer that goes to the 'OutputThread' once 
+ * it is full.
+ */
+class OrderedWriter {
+public:
+    /**
+     * This is the constructor.
+     *
+     * @param output The thread to write with.
+     * @param window How many genomes can be in flight at once.
+     */
+    OrderedWriter(OutputThread& output, BigInt window) 
+        : output(output), slots(window), ready(window, false) {
+        pending.reserve(OutputThread::OUTPUT_BUFFER);
+    }
+
+    /**
+     * This is the function that will hand out the next sequence number.  It 
+     * blocks while the reorder buffer is full.
+     *
+     * @returns The sequence number to put the genome's text under.
+     */
+    BigInt reserve() {
+        std::unique_lock<std::mutex> lock(writeLock);
+        room.wait(lock, [this] { return reserved < next + slots.size(); });
+        return reserved++;
+    }  // End of the 'reserve' function
+
+    /**
+     * This is the function that will hand over the text of a genome.  It is 
+     * written right away if every earlier genome has been written, and only 
+     * copied if it has to wait on one.  A genome with a lot of text can hand 
+     * it over in parts, in order, so it streams out while it is the oldest.
+     *
+     * @param seq The sequence number from 'reserve'.
+     * @param text The text to write.
+     * @param last False if more of the genome's text is still to come.
+     */
+    void put(BigInt seq, std::string_view text, bool last = true) {
+        std::lock_guard<std::mutex> lock(writeLock);
+        if (seq != next) {
+            slots[seq % slots.size()].append(text.data(), text.size());
+            ready[seq % slots.size()] = last;
+            return;
+        }
+        pending.append(text.data(), text.size());
+        if (last) {
+            next++;
+            // Take the parts of the genomes after it that are in, up to the 
+            // first one that isn't done
+            while (true) {
+                std::string& slot = slots[next % slots.size()];
+                pending += slot;
+                std::string().swap(slot);
+                if (!ready[next % slots.size()]) {
+                    break;
+                }
+                ready[next % slots.size()] = false;
+                next++;
+            }
+            room.notify_all();
+        }
+        if (pending.size() >= OutputThread::OUTPUT_BUFFER) {
+            output.submit(pending);
+        }
+    }  // End of the 'put' function
+
+    /**
+     * This is the function that will send what has been gathered so far to 
+     * the output thread.  Everything must have been put by then.
+     */
+    void flush() {
+        std::lock_guard<std::mutex> lock(writeLock);
+        if (!pending.empty()) {
+            output.submit(pending);
+        }
+    }  // End of the 'flush' function
+
+private:
+    OutputThread& output;
+    std::string pending;             // In order text not sent yet
+    std::vector<std::string> slots;  // Text waiting on an earlier genome
+    std::vector<bool> ready;         // Which slots hold text
+    BigInt next = 0;                 // Sequence number to write next
+    BigInt reserved = 0;             // Sequence number to hand out next
+    std::mutex writeLock;
+    std::condition_variable room;    // Signaled when 'next' moves
+};  // End of the 'OrderedWriter' class
+
 // Globals to have on the heap
 int numThreads;
-std::mutex mute;
-std::fstream ofile;
+ThreadPool* pool;  // Created once in main and shared by every stage
+OrderedWriter* writer;  // Puts the output of every stage in file order
+std::string kernelName = "auto";  // Kernel requested with --kernel
+bool verifyCounts = false;       // Recount with 'countTable' (--verify)
+bool useIndex = true;            // Read and write .fai files (--no-index)
+BigInt pieceSize = 4 << 20;      // Bytes of a genome counted per task
+BigInt outputWindow = 4096;      // Genomes in flight at once (--window)
+BigInt blockSize = 16 << 20;     // Bytes read at a time from a stream
+bool forceStream = false;        // Stream even a regular file (--stream)
+std::string adviceName = "normal";  // How the mmap is read (--advise)
+bool prefetch = false;           // Workers prefetch ahead (--advise=prefetch)
+bool hugePages = false;          // Ask for huge pages (--huge-pages)
+const BigInt PREFETCH_BYTES = 2 << 20;  // Bytes a worker prefetches ahead
+BigInt memLimit = 0;             // Bytes of the file resident (--mem-limit)
+std::string ioEngine = "mmap";   // How regular files are read (--io)
+std::string fileList;            // File of paths to read (--file-list)
+std::vector<std::string> inputPaths;  // Every file asked for, in order
+std::string outputFormat = "table";  // How the stats are written (--format)
+std::string outputPath = "out.txt";  // Where the stats go (-o, '-' is stdout)
+bool usePack = false;            // Build and use .2bit caches (--pack)
+std::vector<std::string> recordNames;  // Genomes to count, sorted (--records)
+std::string gcTrack;             // GC track to write instead (--gc-track)
+BigInt gcWindow = 1000;          // Bases in each window of the GC track
+BigInt gcStep = 0;               // Bases between windows, 0 for 'gcWindow'
+int kmerSize = 0;                // Count k-mers of this size (--kmer)
+bool canonicalKmers = false;     // Count k-mers with their reverse complement
+std::string kmerDump;            // Where every k-mer goes (--kmer-dump)
+bool findGaps = false;           // Write the runs of N instead (--gaps)
+BigInt minGap = 1;               // Shortest run of N written (--min-gap)
+bool softMask = false;           // Write the lower case runs (--soft-mask)
+BigInt runPieces = 0;            // Pieces of runs staged and not written
+std::mutex runLock;              // Guards 'runPieces'
+std::condition_variable runRoom;  // Signaled when a piece of runs is written
+CountKernel countKernel;         // Kernel picked by 'selectKernel'
+ScanKernel scanKernel;           // Kernel picked by 'selectKernel'
+PackedKernel packedKernel;       // Kernel picked by 'selectKernel'
+PairKernel pairKernel;           // Kernel picked by 'selectKernel'
+RunKernel runKernel;             // Kernel picked by 'selectKernel'
+bool countPairs = false;         // Count dinucleotides (--dinucleotides)
+
+/**
+ * This is a struct to help manage getting descriptions of genomes from the 
+ * file.  The description points into the mmaped file, so it is only good 
+ * while the file is mapped.
+ */
+struct Description {
+    std::string_view desc;  // To hold the description of the genome
+    BigInt ending;     // To hold the index that the description ended at
+};  // End of the 'Description' struct
+
+/**
+ * This is a struct to hold one line of a samtools compatible .fai index.
+ */
+struct FaiEntry {
+    std::string name;  // The description up to the first whitespace
+    BigInt length;     // Number of bases in the genome
+    BigInt offset;     // Index of the genome's first base in the file
+    BigInt lineBases;  // Bases on each full line
+    BigInt lineWidth;  // Bytes in each full line, line ending included
+};  // End of the 'FaiEntry' struct
+
+/**
+ * These are the structs written by --format=bin, so the output can be mmaped 
+ * and used as an array.  The header comes first, then one record for each 
+ * genome.  Every field is in host byte order.  With --dinucleotides each 
+ * record is followed by its 16 pair counts, which 'recordSize' takes in.
+ */
+struct BinHeader {
+    char magic[8] = {'B', 'I', 'O', 'U', 'T', 'I', 'L', '\0'};
+    uint32_t version = 1;
+    uint32_t recordSize = 8 * (3 + 2 * NUM_RESIDUES);
+};  // End of the 'BinHeader' struct
+
+struct BinRecord {
+    uint64_t file;                  // Index of the file in the list of inputs
+    uint64_t offset;                // Index of the genome's '>' in the file
+    uint64_t upper[NUM_RESIDUES];   // Upper case counts, in 'RESIDUES' order
+    uint64_t lower[NUM_RESIDUES];   // Lower case counts, in 'RESIDUES' order
+    uint64_t invalid;
+};  // End of the 'BinRecord' struct
+
+/**
+ * This is a struct to hold a genome while its pieces are being counted.
+ */
+struct Record {
+    std::string_view desc;  // The description of the genome, in the file
+    BigInt start;       // Index of the genome's '>'
+    BigInt ending;      // Index the description ended at
+    BigInt end;         // Index the genome ended at
+    BigInt numPieces;   // How many pieces the genome is counted in
+    BigInt seq;         // Sequence number for the ordered writer
+    BigInt file;        // Index of the file in the list of inputs
+
+    // The bytes of piece 'p', from the end of the description on
+    BigInt pieceStart(BigInt p) const { return ending + p * pieceSize; }
+    BigInt pieceEnd(BigInt p) const {
+        return std::min(end, pieceStart(p) + pieceSize);
+    }
+};  // End of the 'Record' struct
+
+/**
+ * This is a struct to add up the pieces of a genome while they are being 
+ * counted.  There is one for each genome the writer lets be in flight.
+ */
+struct Tally {
+    std::mutex lock;                 // Guards 'counts'
+    Counts counts;                   // The pieces counted so far
+    std::atomic<BigInt> remaining;   // Pieces still being counted
+};  // End of the 'Tally' struct
+
+/**
+ * This is a struct to hold a genome while its GC track is being made.  The 
+ * pieces first count their bases, so each knows the base it starts at.  Then 
+ * they count the G & C in every block of 'blockBases' bases, which the 
+ * windows are made of.  A block can straddle two pieces, so its counts are 
+ * atomic.
+ */
+struct TrackRecord {
+    Record record;
+    BigIVec firstBase;             // Base each piece starts at, then the total
+    BigInt blockBases;             // Bases in each block
+    std::unique_ptr<std::atomic<BigInt>[]> gc;    // G & C in each block
+    std::unique_ptr<std::atomic<BigInt>[]> acgt;  // A, C, G & T in each block
+    std::atomic<BigInt> remaining;  // Pieces still being counted
+};  // End of the 'TrackRecord' struct
+
+/**
+ * This is a struct to hold a genome while its gaps or soft-masked runs are 
+ * being found.  Each piece finds the runs that start in it, in bases from its 
+ * own start, and keeps them until the pieces before it have been searched 
+ * and the base it starts at is known.  Then they are written, a piece at a 
+ * time in order, and let go.
+ */
+struct RunRecord {
+    Record record;
+    std::vector<BigIVec> found;    // The runs of each piece, till written
+    BigIVec bases;                 // Bases in each piece
+    std::vector<bool> searched;    // Pieces that have been searched
+    BigInt written = 0;            // Pieces written so far
+    BigInt firstBase = 0;          // Base the next piece to write starts at
+    bool writing = false;          // True while a task is writing pieces
+    std::mutex lock;               // Guards the fields above
+};  // End of the 'RunRecord' struct
+
+/**
+ * This is a struct to hold an mmaped file while its genomes are being 
+ * counted.  Several files can be in flight at once, so small files keep the 
+ * pool busy next to big ones.
+ */
+struct OpenFile {
+    std::string path;
+    BigInt fileIndex;                // Index of the file in the list of inputs
+    int fd;
+    const char* mem;                 // The mmaped file
+    BigInt size;                     // The size of the file
+    BigIVec indicies;                // Index each genome starts at, and the end
+    std::vector<Record> records;     // The genomes in the file
+    std::unique_ptr<Tally[]> tallies;  // One for each genome in flight
+    bool buildIndex;                 // Write a .fai once counting is done
+    bool buildPack;                  // Write a .2bit once counting is done
+    struct stat stats;               // The stats of the file, for the .2bit
+    std::string faiPath;
+    std::vector<FaiEntry> index;     // The .fai lines being built
+    std::deque<TrackRecord> tracks;  // The genomes, with --gc-track
+    std::deque<RunRecord> runs;      // The genomes, with --gaps or --soft-mask
+    TaskGroup group;                 // The counting tasks for the file
+};  // End of the 'OpenFile' struct
+
+/**
+ * This is a helper function that will prompt out the usage to the user.
+ */
+void usage() {
+    std::cerr << "Usage: ./<EXECUTABLE> [OPTIONS] <PATH_TO_FASTA_FILE>... <NUM_THREADS>\n";
+    std::cerr << "  A PATH_TO_FASTA_FILE of '-' reads from stdin, and a "
+                 "directory reads every file under it\n";
+    std::cerr << "Options:\n";
+    std::cerr << "  --kernel=<auto|scalar|sse4.2|avx2|avx512>  "
+                 "Counting kernel to use (default: auto)\n";
+    std::cerr << "  --verify  Check every count against the scalar table "
+                 "kernel\n";
+    std::cerr << "  --piece-size=<bytes>  Split genomes into pieces of this "
+                 "size for counting (default: 4194304)\n";
+    std::cerr << "  --no-index  Don't read or write a .fai index next to the "
+                 "FASTA file\n";
+    std::cerr << "  --window=<genomes>  Genomes counted ahead of the oldest "
+                 "unwritten one (default: 4096)\n";
+    std::cerr << "  --stream  Read the file as a stream instead of mmaping "
+                 "it, like stdin ('-') and pipes are\n";
+    std::cerr << "  --block-size=<bytes>  Bytes read at a time when streaming "
+                 "(default: 16777216)\n";
+    std::cerr << "  --advise=<normal|sequential|willneed|prefetch|populate>  "
+                 "How the mmaped file is read in (default: normal)\n";
+    std::cerr << "  --huge-pages  Ask for transparent huge pages on the "
+                 "mmaped file\n";
+    std::cerr << "  --mem-limit=<bytes>  Map the file in windows so no more "
+                 "than this much of it is resident\n";
+    std::cerr << "  --file-list=<path>  Also read the files listed in this "
+                 "file, one path per line\n";
+    std::cerr << "  -o <path>, --output=<path>  Where to put the stats, '-' "
+                 "for stdout (default: out.txt)\n";
+    std::cerr << "  --format=<table|tsv|jsonl|bin>  How the stats are "
+                 "written (default: table)\n";
+    std::cerr << "  --pack  Write a .2bit cache next to each FASTA file, and "
+                 "count from it while it is up to date\n";
+    std::cerr << "  --records=<name,...>  Only count the genomes with these "
+                 "names, the description up to the first whitespace\n";
+    std::cerr << "  --dinucleotides  Also count the 16 pairs of adjacent "
+                 "bases and the CpG observed/expected ratio\n";
+    std::cerr << "  --gc-track=<bedgraph|wig>  Write the GC fraction of "
+                 "windows along each genome instead of the stats\n";
+    std::cerr << "  --gc-window=<bases>  Bases in each window of the GC track "
+                 "(default: 1000)\n";
+    std::cerr << "  --gc-step=<bases>  Bases from one window to the next "
+                 "(default: the window)\n";
+    std::cerr << "  --kmer=<k>  Write a histogram of the k-mers in every "
+                 "genome instead of the stats, k up to 63\n";
+    std::cerr << "  --canonical  Count each k-mer together with its reverse "
+                 "complement\n";
+    std::cerr << "  --kmer-dump=<path>  Also write every k-mer and its count "
+                 "to this file\n";
+    std::cerr << "  --gaps  Write the runs of N in every genome as BED instead "
+                 "of the stats\n";
+    std::cerr << "  --min-gap=<bases>  Shortest run of N written with --gaps "
+                 "(default: 1)\n";
+    std::cerr << "  --soft-mask  Write the runs of lower case bases in every "
+                 "genome as BED instead of the stats\n";
+    std::cerr << "  --io=<mmap|direct>  Read regular files with mmap, or with "
+                 "parallel O_DIRECT reads (default: mmap)\n";
+}  // End of the 'usage' function
+
+/**
+ * This is a helper function that will append an integer to a string without 
+ * going through a stream.
+ *
+ * @param out The string to append to.
+ * @param value The integer.
+ */
+void appendInt(std::string& out, BigInt value) {
+    char digits[20];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    out.append(digits, end - digits);
+}  // End of the 'appendInt' function
+
+/**
+ * This is a helper function that will append a fraction to a string, with 
+ * four decimal places.
+ *
+ * @param out The string to append to.
+ * @param value The fraction.
+ */
+void appendFixed(std::string& out, double value) {
+    char digits[32];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value, 
+                              std::chars_format::fixed, 4).ptr;
+    out.append(digits, end - digits);
+}  // End of the 'appendFixed' function
+
+/**
+ * This is a helper function that will append the CpG observed/expected 
+ * ratio of a genome: its CG pairs times its A, C, G & T, over its C times 
+ * its G.
+ *
+ * @param out The string to append to.
+ * @param counts The counts of the genome, with its dinucleotides.
+ * @param none What to append if the genome has no C or no G.
+ */
+void appendCpg(std::string& out, const Counts& counts, const char* none) {
+    // G, C, A & T are the first residues
+    BigInt g = counts.both(0), c = counts.both(1);
+    if (g == 0 || c == 0) {
+        out += none;
+        return;
+    }
+    BigInt bases = g + c + counts.both(2) + counts.both(3);
+    appendFixed(out, static_cast<double>(counts.pairs[CPG_PAIR]) * bases / 
+                     (static_cast<double>(c) * g));
+}  // End of the 'appendCpg' function
+
+/**
+ * This is a helper function that will get the name of a genome, which is its 
+ * description up to the first whitespace, without the '>'.
+ *
+ * @param desc The description of the genome, starting with its '>'.
+ * @returns The name.
+ */
+std::string_view recordName(std::string_view desc) {
+    BigInt nameEnd = 1;
+    while (nameEnd < desc.size() && !isspace(desc[nameEnd])) {
+        nameEnd++;
+    }
+    return desc.substr(std::min<BigInt>(1, desc.size()), nameEnd - 1);
+}  // End of the 'recordName' function
+
+/**
+ * This is a helper function that will append free text to a TSV line, with 
+ * any tab or line ending in it turned into a space, so it stays one field.
+ *
+ * @param out The string to append to.
+ * @param text The text.
+ */
+void appendTsv(std::string& out, std::string_view text) {
+    for (char c : text) {
+        out += (c == '\t' || c == '\n' || c == '\r') ? ' ' : c;
+    }
+}  // End of the 'appendTsv' function
+
+/**
+ * This is a helper function that will append a string to a JSON document, 
+ * quoted and escaped.
+ *
+ * @param out The string to append to.
+ * @param text The string to quote.
+ */
+void appendJson(std::string& out, std::string_view text) {
+    static const char HEX[] = "0123456789abcdef";
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += "\\u00";
+            out += HEX[(c >> 4) & 0xF];
+            out += HEX[c & 0xF];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}  // End of the 'appendJson' function
+
+/**
+ * This is the function that will format the stats collected from the file, 
+ * in the format picked with --format, and append them to 'out'.
+ *
+ * table: G, C, A, T and N are always listed, the IUPAC codes only when they 
+ *        show up.  The masked lines break down the lower case residues 
+ *        included above them.
+ * tsv:   One line per genome, under the header from 'formatHeader'.  Tabs 
+ *        in the path or description are written as spaces.
+ * jsonl: One JSON object per genome.
+ *
+ * In tsv and jsonl the name is the description up to the first whitespace, 
+ * as in the .fai, and the whole description is in a field of its own.
+ * bin:   One 'BinRecord' per genome.
+ *
+ * With --dinucleotides each format also has the 16 pair counts, and all but 
+ * bin the CpG observed/expected ratio.
+ *
+ * @param out The string to append to.
+ * @param desc The description of the genome from the file.
+ * @param file The index of the file in the list of inputs.
+ * @param start The index of the genome's '>' in the file.
+ * @param counts The counts collected for the genome.
+ */
+void formatStats(std::string& out, std::string_view desc, BigInt file, 
+                 BigInt start, const Counts& counts) {
+    // The full description is without the '>', or a CRLF's '\r'
+    std::string_view name = recordName(desc);
+    std::string_view text = desc.substr(desc.empty() ? 0 : 1);
+    if (!text.empty() && text.back() == '\r') {
+        text.remove_suffix(1);
+    }
+    if (outputFormat == "tsv") {
+        appendTsv(out, inputPaths[file]);
+        out += '\t';
+        appendTsv(out, name);
+        out += '\t';
+        appendTsv(out, text);
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            out += '\t';
+            appendInt(out, counts.both(r));
+        }
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            out += '\t';
+            appendInt(out, counts.lower[r]);
+        }
+        out += '\t';
+        appendInt(out, counts.total());
+        out += '\t';
+        appendInt(out, counts.masked());
+        out += '\t';
+        appendInt(out, counts.invalid);
+        if (countPairs) {
+            for (int p = 0; p < 16; p++) {
+                out += '\t';
+                appendInt(out, counts.pairs[p]);
+            }
+            out += '\t';
+            appendCpg(out, counts, "NA");
+        }
+        out += '\n';
+    } else if (outputFormat == "jsonl") {
+        out += "{\"file\":";
+        appendJson(out, inputPaths[file]);
+        out += ",\"name\":";
+        appendJson(out, name);
+        out += ",\"desc\":";
+        appendJson(out, text);
+        out += ",\"offset\":";
+        appendInt(out, start);
+        out += ",\"counts\":{";
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            out += (r == 0) ? "\"" : ",\"";
+            out += RESIDUES[r];
+            out += "\":";
+            appendInt(out, counts.both(r));
+        }
+        out += "},\"masked\":{";
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            out += (r == 0) ? "\"" : ",\"";
+            out += RESIDUES[r];
+            out += "\":";
+            appendInt(out, counts.lower[r]);
+        }
+        out += "},\"total\":";
+        appendInt(out, counts.total());
+        out += ",\"invalid\":";
+        appendInt(out, counts.invalid);
+        if (countPairs) {
+            out += ",\"dinucleotides\":{";
+            for (int p = 0; p < 16; p++) {
+                out += (p == 0) ? "\"" : ",\"";
+                out += PAIR_BASES[p / 4];
+                out += PAIR_BASES[p % 4];
+                out += "\":";
+                appendInt(out, counts.pairs[p]);
+            }
+            out += "},\"cpg_oe\":";
+            appendCpg(out, counts, "null");
+        }
+        out += "}\n";
+    } else if (outputFormat == "bin") {
+        BinRecord rec;
+        rec.file = file;
+        rec.offset = start;
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            rec.upper[r] = counts.upper[r];
+            rec.lower[r] = counts.lower[r];
+        }
+        rec.invalid = counts.invalid;
+        out.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        if (countPairs) {
+            uint64_t pairs[16];
+            std::copy(counts.pairs, counts.pairs + 16, pairs);
+            out.append(reinterpret_cast<const char*>(pairs), sizeof(pairs));
+        }
+    } else {
+        out += '\n';
+        out += desc;
+        out += "\n\n";
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            if (r < NUM_BASES || counts.both(r) > 0) {
+                out += RESIDUES[r];
+                out += ": ";
+                appendInt(out, counts.both(r));
+                out += '\n';
+            }
+        }
+        out += "-----------------------------------";
+        out += "\nTotal: ";
+        appendInt(out, counts.total());
+        out += "\nMasked: ";
+        appendInt(out, counts.masked());
+        out += '\n';
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            if (counts.lower[r] > 0) {
+                out += "Masked ";
+                out += RESIDUES[r];
+                out += ": ";
+                appendInt(out, counts.lower[r]);
+                out += '\n';
+            }
+        }
+        if (counts.invalid > 0) {
+            out += "Invalid: ";
+            appendInt(out, counts.invalid);
+            out += '\n';
+        }
+        if (countPairs) {
+            out += "-----------------------------------\n";
+            for (int p = 0; p < 16; p++) {
+                out += PAIR_BASES[p / 4];
+                out += PAIR_BASES[p % 4];
+                out += ": ";
+                appendInt(out, counts.pairs[p]);
+                out += '\n';
+            }
+            out += "CpG o/e: ";
+            appendCpg(out, counts, "n/a");
+            out += '\n';
+        }
+    }
+}  // End of the 'formatStats' function
+
+/**
+ * This is the function that will format the stats of a genome into this 
+ * thread's buffer and hand them to the writer.  The buffer is reused, so 
+ * formatting doesn't allocate once it has grown.
+ *
+ * @param seq The sequence number from 'reserve'.
+ * @param desc The description of the genome from the file.
+ * @param file The index of the file in the list of inputs.
+ * @param start The index of the genome's '>' in the file.
+ * @param counts The counts collected for the genome.
+ */
+void writeStats(BigInt seq, std::string_view desc, BigInt file, BigInt start,
+                const Counts& counts) {
+    thread_local std::string text;
+    text.clear();
+    formatStats(text, desc, file, start, counts);
+    writer->put(seq, text);
+}  // End of the 'writeStats' function
+
+/**
+ * This is the function that will write what goes at the top of the output: 
+ * the column names for tsv, and the 'BinHeader' for bin.
+ */
+void formatHeader() {
+    std::string text;
+    if (outputFormat == "tsv") {
+        text = "file\tname\tdesc";
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            text += '\t';
+            text += RESIDUES[r];
+        }
+        for (int r = 0; r < NUM_RESIDUES; r++) {
+            text += "\tmasked_";
+            text += RESIDUES[r];
+        }
+        text += "\ttotal\tmasked\tinvalid";
+        if (countPairs) {
+            for (int p = 0; p < 16; p++) {
+                text += '\t';
+                text += PAIR_BASES[p / 4];
+                text += PAIR_BASES[p % 4];
+            }
+            text += "\tcpg_oe";
+        }
+        text += '\n';
+    } else if (outputFormat == "bin") {
+        BinHeader header;
+        if (countPairs) {
+            header.recordSize += 8 * 16;
+        }
+        text.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    writer->put(writer->reserve(), text);
+}  // End of the 'formatHeader' function
+
+/**
+ * This is the function that will get the description of a genome from the file
+ * that is opened.
+ *
+ * @param mem The file that is mmaped.
+ * @param start The index of where the description starts.
+ * @param size The size of the file.
+ * @returns The description struct that contains the name from the file.  And
+ *          the index that the description ends at.
+ */
+Description getDescription(const char* mem, BigInt start, BigInt size) {
+    Description des;
+    const void* nl = memchr(mem + start, '\n', size - start);
+    // A description with no newline runs to the end
+    des.ending = (nl == NULL) ? size : static_cast<const char*>(nl) - mem;
+    des.desc = std::string_view(mem + start, des.ending - start);
+    return des;
+}  // End of the 'getDescription' function
+
+/**
+ * This is the function that will build a histogram of every byte value in a 
+ * range.  The bytes are spread round robin over several banks of counters so 
+ * back to back repeats of the same byte don't wait on each other.  The banks 
+ * are 32 bits wide, so they are reduced into the 64 bit histogram every 
+ * 'HIST_FLUSH' bytes before they can overflow.
+ *
+ * @param mem The start of the bytes to count.
+ * @param len The number of bytes to count.
+ * @param hist The histogram to add to.
+ */
+void histogramBytes(const char* mem, BigInt len, ByteHist& hist) {
+    const BigInt HIST_FLUSH = BigInt(1) << 31;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(mem);
+    uint32_t banks[HIST_BANKS][256];
+    BigInt i = 0;
+    while (i < len) {
+        std::fill(&banks[0][0], &banks[0][0] + HIST_BANKS * 256, 0);
+        BigInt stop = std::min(len, i + HIST_FLUSH);
+        for (; i + HIST_BANKS <= stop; i += HIST_BANKS) {
+            banks[0][bytes[i]]++;
+            banks[1][bytes[i + 1]]++;
+            banks[2][bytes[i + 2]]++;
+            banks[3][bytes[i + 3]]++;
+        }
+        for (; i < stop; i++) {
+            banks[0][bytes[i]]++;
+        }
+        // Reduce the banks into the histogram
+        for (int b = 0; b < HIST_BANKS; b++) {
+            for (int v = 0; v < 256; v++) {
+                hist[v] += banks[b][v];
+            }
+        }
+    }
+}  // End of the 'histogramBytes' function
+
+/**
+ * This is a helper function that will fold a byte histogram into nucleotide 
+ * counts.  Line endings are skipped and every other byte is invalid.
+ *
+ * @param hist The histogram of the bytes.
+ * @param counts The counts to add to.
+ */
+void addHistogram(const ByteHist& hist, Counts& counts) {
+    BigInt bytes = 0;
+    for (int v = 0; v < 256; v++) {
+        bytes += hist.count[v];
+    }
+    BigInt known = hist['\n'] + hist['\r'];
+    for (int r = 0; r < NUM_RESIDUES; r++) {
+        unsigned char code = RESIDUES[r];
+        counts.upper[r] += hist[code];
+        counts.lower[r] += hist[code | 0x20];
+        known += hist[code] + hist[code | 0x20];
+    }
+    counts.invalid += bytes - known;
+    counts.newlines += hist['\n'];
+}  // End of the 'addHistogram' function
+
+/**
+ * This is a helper function that will count a few bytes without building a 
+ * whole histogram.  The vector kernels use it for the bytes left over after 
+ * their last full block.
+ *
+ * @param mem The start of the bytes to count.
+ * @param len The number of bytes to count.
+ * @param counts The counts to add to.
+ */
+void countTail(const char* mem, BigInt len, Counts& counts) {
+    ByteHist hist;
+    for (BigInt i = 0; i < len; i++) {
+        hist[static_cast<unsigned char>(mem[i])]++;
+    }
+    addHistogram(hist, counts);
+}  // End of the 'countTail' function
+
+/**
+ * This is the portable counting kernel.  It runs on any CPU and is the 
+ * baseline that the vector kernels are checked against with --verify.
+ *
+ * @param mem The start of the bytes to count.
+ * @param len The number of bytes to count.
+ * @param counts The counts to add to.
+ */
+void countTable(const char* mem, BigInt len, Counts& counts) {
+    ByteHist hist;
+    histogramBytes(mem, len, hist);
+    addHistogram(hist, counts);
+}  // End of the 'countTable' function
+
+/**
+ * This is the driver shared by the vector kernels.  The chunk kernel counts 
+ * up to 255 vector blocks at a time into 'CHUNK_LANES' totals: G, C, A, T & N 
+ * in either case, then the lower case g, c, a, t & n, then '\n' and '\r'.  If 
+ * those account for every byte of the chunk it is added straight to the 
+ * counts.  Otherwise the chunk holds IUPAC codes or invalid bytes, and it is 
+ * recounted with the table kernel, which sorts out every byte value.
+ *
+ * @param mem The start of the bytes to count.
+ * @param len The number of bytes to count.
+ * @param counts The counts to add to.
+ * @param chunk The chunk kernel to run.
+ * @param width The number of bytes in one of the chunk kernel's blocks.
+ */
+void countChunks(const char* mem, BigInt len, Counts& counts, 
+                 ChunkKernel chunk, BigInt width) {
+    BigInt i = 0;
+    while (len - i >= width) {
+        BigInt blocks = std::min<BigInt>(255, (len - i) / width);
+        BigInt bytes = blocks * width;
+        BigInt lanes[CHUNK_LANES];
+        chunk(mem + i, blocks, lanes);
+        BigInt known = lanes[10] + lanes[11];
+        for (int b = 0; b < NUM_BASES; b++) {
+            known += lanes[b];
+        }
+        if (known == bytes) {
+            for (int b = 0; b < NUM_BASES; b++) {
+                counts.upper[b] += lanes[b] - lanes[NUM_BASES + b];
+                counts.lower[b] += lanes[NUM_BASES + b];
+            }
+            counts.newlines += lanes[10];
+        } else {
+            countTable(mem + i, bytes, counts);
+        }
+        i += bytes;
+    }
+    // Finish the tail that does not fill a whole block
+    countTail(mem + i, len - i, counts);
+}  // End of the 'countChunks' function
+
+#ifdef BIO_UTIL_X86
+/**
+ * This is the SSE4.2 chunk kernel.  Each 16 byte block is compared against 
+ * every byte 'countChunks' asks for, and the 0xFF matches are subtracted from 
+ * 8 bit counters.  255 blocks can't overflow them, so they are only widened 
+ * with a SAD once at the end.  Case is folded by setting the 0x20 bit.
+ *
+ * @param mem The start of the blocks to count.
+ * @param blocks The number of blocks to count, at most 255.
+ * @param lanes The 'CHUNK_LANES' totals to fill in.
+ */
+__attribute__((target("sse4.2")))
+void chunkSSE42(const char* mem, BigInt blocks, BigInt* lanes) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i fold = _mm_set1_epi8(0x20);
+    __m128i acc[CHUNK_LANES];
+    for (int l = 0; l < CHUNK_LANES; l++) acc[l] = zero;
+    for (BigInt b = 0; b < blocks; b++) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mem + b * 16));
+        __m128i f = _mm_or_si128(v, fold);
+        for (int l = 0; l < NUM_BASES; l++) {
+            __m128i lowerCode = _mm_set1_epi8(RESIDUES[l] | 0x20);
+            acc[l] = _mm_sub_epi8(acc[l], _mm_cmpeq_epi8(f, lowerCode));
+            acc[NUM_BASES + l] = _mm_sub_epi8(acc[NUM_BASES + l], 
+                                              _mm_cmpeq_epi8(v, lowerCode));
+        }
+        acc[10] = _mm_sub_epi8(acc[10], _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        acc[11] = _mm_sub_epi8(acc[11], _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    }
+    for (int l = 0; l < CHUNK_LANES; l++) {
+        __m128i sum = _mm_sad_epu8(acc[l], zero);
+        lanes[l] = _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+    }
+}  // End of the 'chunkSSE42' function
+
+/**
+ * This is the AVX2 chunk kernel.  It works the same way as the SSE4.2 one, 
+ * but on 32 byte blocks.
+ *
+ * @param mem The start of the blocks to count.
+ * @param blocks The number of blocks to count, at most 255.
+ * @param lanes The 'CHUNK_LANES' totals to fill in.
+ */
+__attribute__((target("avx2")))
+void chunkAVX2(const char* mem, BigInt blocks, BigInt* lanes) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    __m256i acc[CHUNK_LANES];
+    for (int l = 0; l < CHUNK_LANES; l++) acc[l] = zero;
+    for (BigInt b = 0; b < blocks; b++) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mem + b * 32));
+        __m256i f = _mm256_or_si256(v, fold);
+        for (int l = 0; l < NUM_BASES; l++) {
+            __m256i lowerCode = _mm256_set1_epi8(RESIDUES[l] | 0x20);
+            acc[l] = _mm256_sub_epi8(acc[l], _mm256_cmpeq_epi8(f, lowerCode));
+            acc[NUM_BASES + l] = _mm256_sub_epi8(acc[NUM_BASES + l], 
+                                                 _mm256_cmpeq_epi8(v, lowerCode));
+        }
+        acc[10] = _mm256_sub_epi8(acc[10], _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        acc[11] = _mm256_sub_epi8(acc[11], _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+    }
+    for (int l = 0; l < CHUNK_LANES; l++) {
+        __m256i sum = _mm256_sad_epu8(acc[l], zero);
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), 
+                                     _mm256_extracti128_si256(sum, 1));
+        lanes[l] = _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+    }
+}  // End of the 'chunkAVX2' function
+
+/**
+ * This is the AVX-512 chunk kernel.  The byte compares go straight into mask 
+ * registers, so each match is counted with a masked add.
+ *
+ * @param mem The start of the blocks to count.
+ * @param blocks The number of blocks to count, at most 255.
+ * @param lanes The 'CHUNK_LANES' totals to fill in.
+ */
+__attribute__((target("avx512f,avx512bw")))
+void chunkAVX512(const char* mem, BigInt blocks, BigInt* lanes) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi8(1);
+    const __m512i fold = _mm512_set1_epi8(0x20);
+    __m512i acc[CHUNK_LANES];
+    for (int l = 0; l < CHUNK_LANES; l++) acc[l] = zero;
+    for (BigInt b = 0; b < blocks; b++) {
+        __m512i v = _mm512_loadu_si512(mem + b * 64);
+        __m512i f = _mm512_or_si512(v, fold);
+        for (int l = 0; l < NUM_BASES; l++) {
+            __m512i lowerCode = _mm512_set1_epi8(RESIDUES[l] | 0x20);
+            acc[l] = _mm512_mask_add_epi8(acc[l], 
+                    _mm512_cmpeq_epi8_mask(f, lowerCode), acc[l], one);
+            acc[NUM_BASES + l] = _mm512_mask_add_epi8(acc[NUM_BASES + l], 
+                    _mm512_cmpeq_epi8_mask(v, lowerCode), acc[NUM_BASES + l], one);
+        }
+        acc[10] = _mm512_mask_add_epi8(acc[10], 
+                _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n')), acc[10], one);
+        acc[11] = _mm512_mask_add_epi8(acc[11], 
+                _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r')), acc[11], one);
+    }
+    for (int l = 0; l < CHUNK_LANES; l++) {
+        BigInt sums[8];
+        _mm512_storeu_si512(sums, _mm512_sad_epu8(acc[l], zero));
+        lanes[l] = sums[0] + sums[1] + sums[2] + sums[3] + 
+                   sums[4] + sums[5] + sums[6] + sums[7];
+    }
+}  // End of the 'chunkAVX512' function
+
+/**
+ * These are the vector counting kernels.  They pair each chunk kernel with 
+ * 'countChunks'.
+ *
+ * @param mem The start of the bytes to count.
+ * @param len The number of bytes to count.
+ * @param counts The counts to add to.
+ */
+void countSSE42(const char* mem, BigInt len, Counts& counts) {
+    countChunks(mem, len, counts, chunkSSE42, 16);
+}  // End of the 'countSSE42' function
+
+void countAVX2(const char* mem, BigInt len, Counts& counts) {
+    countChunks(mem, len, counts, chunkAVX2, 32);
+}  // End of the 'countAVX2' function
+
+void countAVX512(const char* mem, BigInt len, Counts& counts) {
+    countChunks(mem, len, counts, chunkAVX512, 64);
+}  // End of the 'countAVX512' function
+#endif  // BIO_UTIL_X86
+
+// The 2-bit code of each byte, used for k-mers and dinucleotides.  A, C, G & 
+// T in either case are 0 to 3, line endings are skipped, and anything else 
+// breaks up the bases on either side of it.
+const unsigned char BASE_BREAK = 4;
+const unsigned char BASE_SKIP = 5;
+const struct BaseCodes {
+    unsigned char code[256];
+    BaseCodes() {
+        std::fill(code, code + 256, BASE_BREAK);
+        for (int b = 0; b < 4; b++) {
+            code[static_cast<unsigned char>(PAIR_BASES[b])] = b;
+            code[static_cast<unsigned char>(PAIR_BASES[b] | 0x20)] = b;
+        }
+        code[static_cast<unsigned char>('\n')] = BASE_SKIP;
+        code[static_cast<unsigned char>('\r')] = BASE_SKIP;
+    }
+} BASE_CODES;
+
+/**
+ * This is the portable dinucleotide kernel.  It counts the pairs of adjacent 
+ * bases whose first base is in [from, to), looking past line endings for the 
+ * second base as far as 'limit'.  A pair with anything but A, C, G or T in 
+ * it isn't counted.  It is the baseline the vector kernels are checked 
+ * against with --verify, and it finishes the bytes they leave over.
+ *
+ * @param mem The char array that holds the bytes.
+ * @param from The first index a pair may start at.
+ * @param to One past the last index a pair may start at.
+ * @param limit One past the last index a pair may end at.
+ * @param pairs The 16 counts to add to, in 'PAIR_BASES' order.
+ */
+void pairScalar(const char* mem, BigInt from, BigInt to, BigInt limit, 
+                BigInt* pairs) {
+    const unsigned char* code = BASE_CODES.code;
+    for (BigInt i = from; i < to; i++) {
+        unsigned char x = code[static_cast<unsigned char>(mem[i])];
+        if (x >= 4) {
+            continue;
+        }
+        BigInt j = i + 1;
+        while (j < limit && code[static_cast<unsigned char>(mem[j])] == BASE_SKIP) {
+            j++;
+        }
+        if (j < limit) {
+            unsigned char y = code[static_cast<unsigned char>(mem[j])];
+            if (y < 4) pairs[x * 4 + y]++;
+        }
+    }
+}  // End of the 'pairScalar' function
+
+/**
+ * This is a struct to hold the compare masks of one vector block for the 
+ * dinucleotide kernels: a bit per byte for each base, in either case, and 
+ * for the line endings.
+ */
+struct PairMasks {
+    uint64_t base[4];
+    uint64_t end;
+};  // End of the 'PairMasks' struct
+
+/**
+ * This is a helper function that will shift a block's mask down by 'k' 
+ * bytes, pulling in the bits of the block after it.
+ */
+template <int W>
+inline uint64_t shiftMask(uint64_t cur, uint64_t next, int k) {
+    const uint64_t FULL = (W == 64) ? ~0ULL : ((1ULL << W) - 1);
+    return ((cur >> k) | (next << (W - k))) & FULL;
+}  // End of the 'shiftMask' function
+
+/**
+ * This is the shifted compare shared by the vector dinucleotide kernels.  The 
+ * base masks are shifted by one byte to pair each base with the next one, and 
+ * by two or three bytes where a '\n' or '\r\n' sits between them.  Each of 
+ * the 16 pairs is then a popcount.  A run of three or more line endings 
+ * after a base is left to the portable kernel, and the three byte shift is 
+ * skipped in blocks with no '\r\n' in them.
+ *
+ * @param cur The masks of the block.
+ * @param next The masks of the block after it.
+ * @param pairs The 16 counts to add to.
+ * @returns False if the block has to be counted by the portable kernel.
+ */
+template <int W>
+inline bool addPairMasks(const PairMasks& cur, const PairMasks& next, 
+                         uint64_t* pairs) {
+    uint64_t e1 = shiftMask<W>(cur.end, next.end, 1);
+    uint64_t e2 = shiftMask<W>(cur.end, next.end, 2);
+    uint64_t e3 = shiftMask<W>(cur.end, next.end, 3);
+    uint64_t bases = cur.base[0] | cur.base[1] | cur.base[2] | cur.base[3];
+    if (bases & e1 & e2 & e3) {
+        return false;
+    }
+    uint64_t second[4];
+    if (e1 & e2) {
+        for (int y = 0; y < 4; y++) {
+            second[y] = shiftMask<W>(cur.base[y], next.base[y], 1) | 
+                        (e1 & shiftMask<W>(cur.base[y], next.base[y], 2)) | 
+                        (e1 & e2 & shiftMask<W>(cur.base[y], next.base[y], 3));
+        }
+    } else {
+        for (int y = 0; y < 4; y++) {
+            second[y] = shiftMask<W>(cur.base[y], next.base[y], 1) | 
+                        (e1 & shiftMask<W>(cur.base[y], next.base[y], 2));
+        }
+    }
+    for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++) {
+            pairs[x * 4 + y] += __builtin_popcountll(cur.base[x] & second[y]);
+        }
+    }
+    return true;
+}  // End of the 'addPairMasks' function
+
+#ifdef BIO_UTIL_X86
+/**
+ * These are the functions that will make the masks of one block for each 
+ * vector dinucleotide kernel.  Case is folded by setting the 0x20 bit.
+ *
+ * @param mem The start of the block.
+ * @returns The masks.
+ */
+__attribute__((target("sse4.2,popcnt")))
+inline PairMasks pairMasksSSE42(const char* mem) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mem));
+    __m128i f = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    PairMasks m;
+    for (int b = 0; b < 4; b++) {
+        m.base[b] = static_cast<uint16_t>(_mm_movemask_epi8(
+                _mm_cmpeq_epi8(f, _mm_set1_epi8(PAIR_BASES[b] | 0x20))));
+    }
+    m.end = static_cast<uint16_t>(_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), 
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')))));
+    return m;
+}  // End of the 'pairMasksSSE42' function
+
+__attribute__((target("avx2,popcnt")))
+inline PairMasks pairMasksAVX2(const char* mem) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mem));
+    __m256i f = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    PairMasks m;
+    for (int b = 0; b < 4; b++) {
+        m.base[b] = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(f, _mm256_set1_epi8(PAIR_BASES[b] | 0x20))));
+    }
+    m.end = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), 
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')))));
+    return m;
+}  // End of the 'pairMasksAVX2' function
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+inline PairMasks pairMasksAVX512(const char* mem) {
+    __m512i v = _mm512_loadu_si512(mem);
+    __m512i f = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+    PairMasks m;
+    for (int b = 0; b < 4; b++) {
+        m.base[b] = _mm512_cmpeq_epi8_mask(f, _mm512_set1_epi8(PAIR_BASES[b] | 0x20));
+    }
+    m.end = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n')) | 
+            _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r'));
+    return m;
+}  // End of the 'pairMasksAVX512' function
+
+/**
+ * These are the vector dinucleotide kernels.  Each block's masks are made 
+ * once and kept as the next block's lookahead.  The pairs are added up in 
+ * locals, which the compiler can keep in registers.  The last block or two, 
+ * which have no full block after them, go to the portable kernel.
+ *
+ * @param mem The char array that holds the bytes.
+ * @param from The first index a pair may start at.
+ * @param to One past the last index a pair may start at.
+ * @param limit One past the last index a pair may end at.
+ * @param pairs The 16 counts to add to, in 'PAIR_BASES' order.
+ */
+__attribute__((target("sse4.2,popcnt")))
+void pairSSE42(const char* mem, BigInt from, BigInt to, BigInt limit, 
+               BigInt* pairs) {
+    BigInt i = from;
+    uint64_t sums[16] = {};
+    if (i + 16 <= to && i + 32 <= limit) {
+        PairMasks cur = pairMasksSSE42(mem + i);
+        for (; i + 16 <= to && i + 32 <= limit; i += 16) {
+            PairMasks next = pairMasksSSE42(mem + i + 16);
+            if (!addPairMasks<16>(cur, next, sums)) {
+                pairScalar(mem, i, i + 16, limit, pairs);
+            }
+            cur = next;
+        }
+    }
+    for (int p = 0; p < 16; p++) pairs[p] += sums[p];
+    pairScalar(mem, i, to, limit, pairs);
+}  // End of the 'pairSSE42' function
+
+__attribute__((target("avx2,popcnt")))
+void pairAVX2(const char* mem, BigInt from, BigInt to, BigInt limit, 
+              BigInt* pairs) {
+    BigInt i = from;
+    uint64_t sums[16] = {};
+    if (i + 32 <= to && i + 64 <= limit) {
+        PairMasks cur = pairMasksAVX2(mem + i);
+        for (; i + 32 <= to && i + 64 <= limit; i += 32) {
+            PairMasks next = pairMasksAVX2(mem + i + 32);
+            if (!addPairMasks<32>(cur, next, sums)) {
+                pairScalar(mem, i, i + 32, limit, pairs);
+            }
+            cur = next;
+        }
+    }
+    for (int p = 0; p < 16; p++) pairs[p] += sums[p];
+    pairScalar(mem, i, to, limit, pairs);
+}  // End of the 'pairAVX2' function
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+void pairAVX512(const char* mem, BigInt from, BigInt to, BigInt limit, 
+                BigInt* pairs) {
+    BigInt i = from;
+    uint64_t sums[16] = {};
+    if (i + 64 <= to && i + 128 <= limit) {
+        PairMasks cur = pairMasksAVX512(mem + i);
+        for (; i + 64 <= to && i + 128 <= limit; i += 64) {
+            PairMasks next = pairMasksAVX512(mem + i + 64);
+            if (!addPairMasks<64>(cur, next, sums)) {
+                pairScalar(mem, i, i + 64, limit, pairs);
+            }
+            cur = next;
+        }
+    }
+    for (int p = 0; p < 16; p++) pairs[p] += sums[p];
+    pairScalar(mem, i, to, limit, pairs);
+}  // End of the 'pairAVX512' function
+#endif  // BIO_UTIL_X86
+
+/**
+ * This is a helper function that will tell if a byte is in the runs being 
+ * found: N or n for gaps, or any lower case letter for soft-masked runs.
+ */
+template <bool LOWER>
+inline bool inRunClass(char c) {
+    return LOWER ? (c >= 'a' && c <= 'z') : (c | 0x20) == 'n';
+}  // End of the 'inRunClass' function
+
+/**
+ * This is the portable run kernel.  It walks the bytes in [from, to), 
+ * skipping line endings, and adds the base each run starts at, and the base 
+ * after it ends, to the scan.  The runs are of N or n, or of lower case with 
+ * 'LOWER'.  A run still going at 'to' is left open for the next call, or for 
+ * the caller to close.
+ *
+ * @param mem The char array that holds the bytes.
+ * @param from The index to start at.
+ * @param to One past the last index to walk.
+ * @param scan The search so far.
+ */
+template <bool LOWER>
+void runScalar(const char* mem, BigInt from, BigInt to, RunScan& scan) {
+    for (BigInt i = from; i < to; i++) {
+        char c = mem[i];
+        if (c == '\n' || c == '\r') {
+            continue;
+        }
+        bool in = inRunClass<LOWER>(c);
+        if (in != scan.inRun) {
+            scan.runs.push_back(scan.base);
+            scan.inRun = in;
+        }
+        scan.base++;
+    }
+}  // End of the 'runScalar' function
+
+/**
+ * This is the run walk shared by the vector run kernels.  It hops from one 
+ * edge of a run to the next with a count of trailing zeros: while in a run 
+ * the next edge is the next byte that is neither in the run nor a line 
+ * ending, otherwise it is the next byte in the run.  A block with no edges in 
+ * it costs a single test.  The base of an edge is its byte less the line 
+ * endings in front of it.
+ *
+ * @param run The mask of the bytes in the block that are in the run.
+ * @param end The mask of the line endings in the block.
+ * @param scan The search so far.
+ */
+template <int W>
+inline void addRunMasks(uint64_t run, uint64_t end, RunScan& scan) {
+    const uint64_t FULL = (W == 64) ? ~0ULL : ((1ULL << W) - 1);
+    uint64_t other = ~(run | end) & FULL;
+    uint64_t left = FULL;
+    for (;;) {
+        uint64_t edges = (scan.inRun ? other : run) & left;
+        if (edges == 0) {
+            break;
+        }
+        int i = __builtin_ctzll(edges);
+        uint64_t before = (1ULL << i) - 1;
+        scan.runs.push_back(scan.base + i - __builtin_popcountll(end & before));
+        scan.inRun = !scan.inRun;
+        left &= ~((before << 1) | 1);
+    }
+    scan.base += W - __builtin_popcountll(end);
+}  // End of the 'addRunMasks' function
+
+#ifdef BIO_UTIL_X86
+/**
+ * These are the vector run kernels.  For gaps each block is compared against 
+ * 'n' with case folded.  For soft-masked runs 'a' is taken off each byte, so 
+ * the lower case letters are the bytes no more than 25, unsigned.  Each block 
+ * is compared against the line endings too, and the masks are walked by 
+ * 'addRunMasks'.  The bytes left over go to the portable kernel.
+ *
+ * @param mem The char array that holds the bytes.
+ * @param from The index to start at.
+ * @param to One past the last index to walk.
+ * @param scan The search so far.
+ */
+template <bool LOWER>
+__attribute__((target("sse4.2,popcnt")))
+void runSSE42(const char* mem, BigInt from, BigInt to, RunScan& scan) {
+    BigInt i = from;
+    for (; i + 16 <= to; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mem + i));
+        __m128i in;
+        if (LOWER) {
+            __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('a'));
+            in = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(25)), d);
+        } else {
+            in = _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), 
+                                _mm_set1_epi8('n'));
+        }
+        uint64_t run = static_cast<uint16_t>(_mm_movemask_epi8(in));
+        uint64_t end = static_cast<uint16_t>(_mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), 
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')))));
+        addRunMasks<16>(run, end, scan);
+    }
+    runScalar<LOWER>(mem, i, to, scan);
+}  // End of the 'runSSE42' function
+
+template <bool LOWER>
+__attribute__((target("avx2,popcnt")))
+void runAVX2(const char* mem, BigInt from, BigInt to, RunScan& scan) {
+    BigInt i = from;
+    for (; i + 32 <= to; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mem + i));
+        __m256i in;
+        if (LOWER) {
+            __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('a'));
+            in = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(25)), d);
+        } else {
+            in = _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 
+                                   _mm256_set1_epi8('n'));
+        }
+        uint64_t run = static_cast<uint32_t>(_mm256_movemask_epi8(in));
+        uint64_t end = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), 
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')))));
+        addRunMasks<32>(run, end, scan);
+    }
+    runScalar<LOWER>(mem, i, to, scan);
+}  // End of the 'runAVX2' function
+
+template <bool LOWER>
+__attribute__((target("avx512f,avx512bw,popcnt")))
+void runAVX512(const char* mem, BigInt from, BigInt to, RunScan& scan) {
+    BigInt i = from;
+    for (; i + 64 <= to; i += 64) {
+        __m512i v = _mm512_loadu_si512(mem + i);
+        uint64_t run;
+        if (LOWER) {
+            run = _mm512_cmple_epu8_mask(
+                    _mm512_sub_epi8(v, _mm512_set1_epi8('a')), 
+                    _mm512_set1_epi8(25));
+        } else {
+            run = _mm512_cmpeq_epi8_mask(
+                    _mm512_or_si512(v, _mm512_set1_epi8(0x20)), 
+                    _mm512_set1_epi8('n'));
+        }
+        uint64_t end = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n')) | 
+                       _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r'));
+        addRunMasks<64>(run, end, scan);
+    }
+    runScalar<LOWER>(mem, i, to, scan);
+}  // End of the 'runAVX512' function
+#endif  // BIO_UTIL_X86
+
+/**
+ * This is the portable header scanning kernel.  A genome starts at a '>' that 
+ * is the first byte of a line, so it uses memchr to hop from newline to 
+ * newline and only looks at the byte after each one.  The '>' at offset 0 
+ * is the only one without a newline in front of it.
+ *
+ * @param mem The char array that holds the contents of the FASTA file.
+ * @param start The first index that may hold a '>'.
+ * @param end One past the last index that may hold a '>'.
+ * @param found The vector to append the indicies of the headers to.
+ */
+void scanScalar(const char* mem, BigInt start, BigInt end, BigIVec& found) {
+    BigInt i = start;
+    if (i == 0 && end > 0) {
+        if (mem[0] == '>') found.push_back(0);
+        i = 1;
+    }
+    // Look for newlines in front of the indicies [i, end)
+    while (i < end) {
+        const void* nl = memchr(mem + i - 1, '\n', end - i);
+        if (nl == NULL) break;
+        BigInt pos = static_cast<const char*>(nl) - mem + 1;
+        if (mem[pos] == '>') found.push_back(pos);
+        i = pos + 1;
+    }
+}  // End of the 'scanScalar' function
+
+#ifdef BIO_UTIL_X86
+/**
+ * These are the vector header scanning kernels.  Each block is loaded twice, 
+ * once as is and once shifted back a byte.  The '>' matches of the first are 
+ * ANDed with the '\n' matches of the second, so only a '>' that starts a line 
+ * sets a bit in the mask.  The bytes that don't fill a block are left to 
+ * 'scanScalar'.
+ *
+ * @param mem The char array that holds the contents of the FASTA file.
+ * @param start The first index that may hold a '>'.
+ * @param end One past the last index that may hold a '>'.
+ * @param found The vector to append the indicies of the headers to.
+ */
+__attribute__((target("sse4.2")))
+void scanSSE42(const char* mem, BigInt start, BigInt end, BigIVec& found) {
+    BigInt i = start;
+    if (i == 0 && end > 0) {
+        if (mem[0] == '>') found.push_back(0);
+        i = 1;
+    }
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= end; i += 16) {
+        __m128i cur  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mem + i));
+        __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mem + i - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(cur, gt), 
+                                                        _mm_cmpeq_epi8(prev, nl)));
+        while (mask != 0) {
+            found.push_back(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    scanScalar(mem, i, end, found);
+}  // End of the 'scanSSE42' function
+
+__attribute__((target("avx2")))
+void scanAVX2(const char* mem, BigInt start, BigInt end, BigIVec& found) {
+    BigInt i = start;
+    if (i == 0 && end > 0) {
+        if (mem[0] == '>') found.push_back(0);
+        i = 1;
+    }
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; i + 32 <= end; i += 32) {
+        __m256i cur  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mem + i));
+        __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mem + i - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(cur, gt), _mm256_cmpeq_epi8(prev, nl)));
+        while (mask != 0) {
+            found.push_back(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    scanScalar(mem, i, end, found);
+}  // End of the 'scanAVX2' function
+
+__attribute__((target("avx512f,avx512bw")))
+void scanAVX512(const char* mem, BigInt start, BigInt end, BigIVec& found) {
+    BigInt i = start;
+    if (i == 0 && end > 0) {
+        if (mem[0] == '>') found.push_back(0);
+        i = 1;
+    }
+    const __m512i gt = _mm512_set1_epi8('>');
+    const __m512i nl = _mm512_set1_epi8('\n');
+    for (; i + 64 <= end; i += 64) {
+        __m512i cur  = _mm512_loadu_si512(mem + i);
+        __m512i prev = _mm512_loadu_si512(mem + i - 1);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(cur, gt) & 
+                        _mm512_cmpeq_epi8_mask(prev, nl);
+        while (mask != 0) {
+            found.push_back(i + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+    scanScalar(mem, i, end, found);
+}  // End of the 'scanAVX512' function
+#endif  // BIO_UTIL_X86
+
+/**
+ * These are the kernels that count the 2-bit codes in whole 64 bit words of 
+ * a .2bit file's packed bases: T is 00, C is 01, A is 10 and G is 11.  The 
+ * high bit of each code is shifted onto the low bit, so three popcounts give 
+ * every code but T, which is whatever is left.  The popcnt kernel is the 
+ * same code built for the instruction, and is picked with the vector kernels.
+ *
+ * @param dna The start of the words.
+ * @param words The number of words to count.
+ * @param codes The counts to add to, by code.
+ */
+static inline void countPackedWords(const unsigned char* dna, BigInt words,
+                                    BigInt* codes) {
+    const uint64_t LOW = 0x5555555555555555ULL;
+    BigInt c = 0, a = 0, g = 0;
+    for (BigInt w = 0; w < words; w++) {
+        uint64_t word;
+        memcpy(&word, dna + w * 8, 8);
+        uint64_t hi = (word >> 1) & LOW;
+        uint64_t lo = word & LOW;
+        g += __builtin_popcountll(hi & lo);
+        a += __builtin_popcountll(hi & ~lo);
+        c += __builtin_popcountll(~hi & lo);
+    }
+    codes[0] += words * 32 - c - a - g;
+    codes[1] += c;
+    codes[2] += a;
+    codes[3] += g;
+}  // End of the 'countPackedWords' function
+
+void packedScalar(const unsigned char* dna, BigInt words, BigInt* codes) {
+    countPackedWords(dna, words, codes);
+}  // End of the 'packedScalar' function
+
+#ifdef BIO_UTIL_X86
+__attribute__((target("popcnt")))
+void packedPopcnt(const unsigned char* dna, BigInt words, BigInt* codes) {
+    countPackedWords(dna, words, codes);
+}  // End of the 'packedPopcnt' function
+#endif  // BIO_UTIL_X86
+
+/**
+ * This is a helper function that will pick the counting, header scanning, 
+ * packed counting, dinucleotide and run kernels once at startup.  When the 
+ * user asks for 'auto' it takes the widest kernel the CPU supports.  Asking 
+ * for a kernel the CPU can't run is an error.
+ *
+ * @param name The name of the kernel requested by the user.
+ * @returns The name of the kernel that was picked.
+ */
+std::string selectKernel(const std::string& name) {
+    countKernel = countTable;
+    scanKernel = scanScalar;
+    packedKernel = packedScalar;
+    pairKernel = pairScalar;
+    runKernel = softMask ? runScalar<true> : runScalar<false>;
+    std::string picked = "scalar";
+#ifdef BIO_UTIL_X86
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f") && 
+                  __builtin_cpu_supports("avx512bw");
+    bool avx2   = __builtin_cpu_supports("avx2");
+    bool sse42  = __builtin_cpu_supports("sse4.2");
+    if (name != "scalar" && __builtin_cpu_supports("popcnt")) {
+        packedKernel = packedPopcnt;
+    }
+    if ((name == "auto" && avx512) || name == "avx512") {
+        if (!avx512) throw std::runtime_error("CPU does not support avx512");
+        countKernel = countAVX512;
+        scanKernel = scanAVX512;
+        pairKernel = pairAVX512;
+        runKernel = softMask ? runAVX512<true> : runAVX512<false>;
+        picked = "avx512";
+    } else if ((name == "auto" && avx2) || name == "avx2") {
+        if (!avx2) throw std::runtime_error("CPU does not support avx2");
+        countKernel = countAVX2;
+        scanKernel = scanAVX2;
+        pairKernel = pairAVX2;
+        runKernel = softMask ? runAVX2<true> : runAVX2<false>;
+        picked = "avx2";
+    } else if ((name == "auto" && sse42) || name == "sse4.2") {
+        if (!sse42) throw std::runtime_error("CPU does not support sse4.2");
+        countKernel = countSSE42;
+        scanKernel = scanSSE42;
+        pairKernel = pairSSE42;
+        runKernel = softMask ? runSSE42<true> : runSSE42<false>;
+        picked = "sse4.2";
+    }
+#endif
+    if (name != "auto" && name != picked) {
+        throw std::runtime_error("Unknown or unsupported kernel: " + name);
+    }
+    return picked;
+}  // End of the 'selectKernel' function
+
+/**
+ * This is the function that will read each nucleotide in a range of the file 
+ * and collect thier counts.  It will be run as a task so that it can be 
+ * parallelized.  The counting itself is done by the kernel picked in 
+ * 'selectKernel'.  With --dinucleotides the pairs that start in the range 
+ * are counted too, looking ahead as far as 'limit' for their second base.
+ *
+ * @param desc The description of the genome from the file. 
+ * @param start The starting index of the range.
+ * @param end The ending index of the range.
+ * @param limit One past the last index a pair may end at.
+ * @param mem The char array of the file.
+ * @param counts The counts to fill in.
+ */
+void collectCounts(std::string_view desc, BigInt start, BigInt end, 
+                   BigInt limit, const char* mem, Counts& counts) {
+    countKernel(mem + start, end - start, counts);
+    if (countPairs) {
+        pairKernel(mem, start, end, limit, counts.pairs);
+    }
+    if (verifyCounts) {
+        Counts check;
+        countTable(mem + start, end - start, check);
+        if (countPairs) {
+            pairScalar(mem, start, end, limit, check.pairs);
+        }
+        if (!(check == counts)) {
+            std::cerr << "Kernel counts do not match the table counts for " 
+                      << desc << std::endl;
+            exit(-1);
+        }
+    }
+}  // End of the 'collectCounts' function
+
+/**
+ * This is the function that will work out the .fai line of a genome once it 
+ * has been counted.  Like samtools, it needs every line but the last to hold 
+ * the same number of bases.  Rather than look at every byte again, it checks 
+ * that a newline sits at the end of each full line and that the counted 
+ * newlines match the number of lines.  Blank lines at the end of the genome 
+ * are allowed.
+ *
+ * @param record The genome.
+ * @param counts The counts for the whole genome.
+ * @param mem The char array that contains the FASTA file.
+ * @param entry The .fai line to fill in.
+ * @returns False if the genome's lines can't be described by a .fai line.
+ */
+bool indexRecord(const Record& record, const Counts& counts, const char* mem, 
+                 FaiEntry& entry) {
+    // The name is the description up to the first whitespace
+    BigInt nameEnd = record.start + 1;
+    while (nameEnd < record.ending && !isspace(mem[nameEnd])) {
+        nameEnd++;
+    }
+    entry.name.assign(mem + record.start + 1, nameEnd - record.start - 1);
+    if (entry.name.empty()) {
+        return false;
+    }
+    entry.offset = std::min(record.ending + 1, record.end);
+
+    // Leave out the blank lines at the end of the genome
+    BigInt seqEnd = record.end;
+    BigInt newlines = counts.newlines - (record.ending < record.end ? 1 : 0);
+    while (seqEnd > entry.offset && 
+           (mem[seqEnd - 1] == '\n' || mem[seqEnd - 1] == '\r')) {
+        if (mem[seqEnd - 1] == '\n') newlines--;
+        seqEnd--;
+    }
+    if (seqEnd == entry.offset) {
+        entry.length = entry.lineBases = entry.lineWidth = 0;
+        return true;
+    }
+
+    // The first line sets the width that every full line must have
+    const char* first = static_cast<const char*>(
+            memchr(mem + entry.offset, '\n', seqEnd - entry.offset));
+    if (first == NULL) {
+        entry.length = entry.lineBases = seqEnd - entry.offset;
+        entry.lineWidth = entry.lineBases + 1;
+        return true;
+    }
+    entry.lineWidth = first - (mem + entry.offset) + 1;
+    bool crlf = entry.lineWidth > 1 && first[-1] == '\r';
+    entry.lineBases = entry.lineWidth - (crlf ? 2 : 1);
+    if (entry.lineBases == 0) {
+        return false;
+    }
+    for (BigInt line = 1; line <= newlines; line++) {
+        BigInt nl = entry.offset + line * entry.lineWidth - 1;
+        if (nl >= seqEnd || mem[nl] != '\n' || (crlf && mem[nl - 1] != '\r')) {
+            return false;
+        }
+    }
+    BigInt last = seqEnd - (entry.offset + newlines * entry.lineWidth);
+    if (last == 0 || last > entry.lineBases) {
+        return false;
+    }
+    entry.length = newlines * entry.lineBases + last;
+    return true;
+}  // End of the 'indexRecord' function
+
+/**
+ * This is a helper function that will ask the kernel to start reading a 
+ * range of the mmaped file, when --advise=prefetch was picked.  Each worker 
+ * calls it for the bytes just ahead of where it is reading, so every worker 
+ * gets readahead of its own instead of sharing the one sequential stream.
+ *
+ * @param mem The char array that contains the FASTA file.
+ * @param start The first byte of the range.
+ * @param end One past the last byte of the range.
+ */
+void prefetchRange(const char* mem, BigInt start, BigInt end) {
+    if (!prefetch || start >= end) {
+        return;
+    }
+    // madvise wants a page aligned address
+    static const BigInt page = sysconf(_SC_PAGESIZE);
+    uintptr_t from = reinterpret_cast<uintptr_t>(mem + start) & ~(page - 1);
+    uintptr_t to = reinterpret_cast<uintptr_t>(mem + end);
+    madvise(reinterpret_cast<void*>(from), to - from, MADV_WILLNEED);
+}  // End of the 'prefetchRange' function
+
+/**
+ * This is the task that counts one piece of a genome.  The task that finishes 
+ * the last piece of a genome formats the stats and hands them to the writer.
+ *
+ * @param record The genome.
+ * @param r The index of the genome.
+ * @param tally The tally for the genome's pieces.
+ * @param p The index of the piece within the genome.
+ * @param mem The char array that contains the FASTA file.
+ * @param index The .fai lines to fill in, or NULL to skip them.
+ */
+void countPiece(const Record& record, BigInt r, Tally& tally, BigInt p, 
+                const char* mem, std::vector<FaiEntry>* index) {
+    BigInt start = record.pieceStart(p);
+    BigInt end = record.pieceEnd(p);
+    // Ask for this piece and the one after it in the genome
+    prefetchRange(mem, start, std::min(record.end, end + pieceSize));
+    Counts counts;
+    collectCounts(record.desc, start, end, record.end, mem, counts);
+    if (record.numPieces > 1) {
+        {  // Critical section
+        std::lock_guard<std::mutex> lock(tally.lock);
+        tally.counts += counts;
+        }
+        if (--tally.remaining > 0) {
+            return;
+        }
+        counts = tally.counts;
+    }
+    writeStats(record.seq, record.desc, record.file, record.start, counts);
+    if (index != NULL) {
+        FaiEntry& entry = (*index)[r];
+        if (!indexRecord(record, counts, mem, entry)) {
+            entry.name.clear();
+        }
+    }
+}  // End of the 'countPiece' function
+
+/**
+ * This is a helper function that will check a genome against the names 
+ * asked for with --records.
+ *
+ * @param desc The description of the genome, starting with its '>'.
+ * @returns True if the genome should be counted.
+ */
+bool wantRecord(std::string_view desc) {
+    if (recordNames.empty()) {
+        return true;
+    }
+    return std::binary_search(recordNames.begin(), recordNames.end(), 
+                              recordName(desc));
+}  // End of the 'wantRecord' function
+
+/**
+ * This is a helper function that will find the genomes of an mmaped file 
+ * that are asked for with --records, or all of them.  Genomes bigger than 
+ * 'pieceSize' are split into pieces of that size, always at least one, so 
+ * the pool can share one giant chromosome just as well as many small 
+ * contigs.  Every mode stages its tasks from these.
+ *
+ * @param file The mmaped file, with its indicies found.  Its 'records' are 
+ *             filled in.
+ */
+void findRecords(OpenFile& file) {
+    const char* mem = file.mem;
+    BigIVec& indicies = file.indicies;
+    for (BigInt i = 0; i < (indicies.size() - 1); i++) {
+        // Get the desciption
+        Description des = getDescription(mem, indicies[i], file.size);
+        if (!wantRecord(des.desc)) {
+            continue;
+        }
+        Record record;
+        record.desc = des.desc;
+        record.start = indicies[i];
+        record.ending = des.ending;
+        record.end = indicies[i + 1];
+        record.file = file.fileIndex;
+        record.numPieces = std::max<BigInt>(1, 
+                (record.end - record.ending + pieceSize - 1) / pieceSize);
+        file.records.push_back(record);
+    }
+}  // End of the 'findRecords' function
+
+/**
+ * This is a helper function that will stage the tasks for counting 
+ * nucleotides in each genome, a task for each piece.  The stats come out in 
+ * file order.  It doesn't wait for the tasks, so the next file can be staged 
+ * while they run.
+ *
+ * @param file The mmaped file, with its indicies found.  Its .fai lines are 
+ *             filled in if it has 'buildIndex' set.  A genome that can't be 
+ *             indexed is left with an empty name.  Only the genomes asked 
+ *             for with --records are counted.
+ */
+void stageCollections(OpenFile& file) {
+    std::cout << "Counting nucleotides...\n";
+    const char* mem = file.mem;
+    std::vector<Record>& records = file.records;
+    findRecords(file);
+    std::vector<FaiEntry>* index = NULL;
+    if (file.buildIndex) {
+        file.index.resize(records.size());
+        index = &file.index;
+    }
+
+    // Hand the pieces to the thread pool in file order.  The writer blocks 
+    // here while 'outputWindow' genomes are in flight, and a genome's tally 
+    // is free to reuse once the genome 'outputWindow' before it is written.
+    BigInt numTallies = std::max<BigInt>(1, 
+            std::min<BigInt>(outputWindow, records.size()));
+    file.tallies.reset(new Tally[numTallies]);
+    for (BigInt r = 0; r < records.size(); r++) {
+        Record& record = records[r];
+        record.seq = writer->reserve();
+        Tally& tally = file.tallies[r % numTallies];
+        tally.counts = Counts();
+        tally.remaining = record.numPieces;
+        for (BigInt p = 0; p < record.numPieces; p++) {
+            pool->submit(file.group, [&record, r, &tally, p, mem, index] {
+                countPiece(record, r, tally, p, mem, index);
+            });
+        }
+    }
+}  // End of the 'stageCollections' function
+
+/**
+ * This is a helper function that will find the byte after the next 'n' bases 
+ * of a line, skipping any '\r' in it.
+ *
+ * @param mem The char array that contains the FASTA file.
+ * @param pos The index to start at.
+ * @param n The number of bases, no more than are left in the line.
+ * @returns The index after the last of the bases.
+ */
+BigInt skipBases(const char* mem, BigInt pos, BigInt n) {
+    if (memchr(mem + pos, '\r', n) == NULL) {
+        return pos + n;
+    }
+    for (; n > 0; pos++) {
+        if (mem[pos] != '\r') n--;
+    }
+    return pos;
+}  // End of the 'skipBases' function
+
+/**
+ * This is the function that will format the GC track of a genome, in the 
+ * format picked with --gc-track, and hand it to the writer.  Windows without 
+ * any A, C, G or T are left out.  When the step is shorter than the window, 
+ * the windows overlap, which bedGraph and wig consumers reject.  So each 
+ * window's fraction is given to the step's worth of bases at its centre, 
+ * which tile the genome without overlapping.  The text goes over in parts 
+ * as it fills a buffer, so a long genome's track isn't held whole.
+ *
+ * bedgraph: One line per window.  The windows that run past the end of the 
+ *           genome are cut short there, as are their lines.
+ * wig:      fixedStep, with only whole windows, since every line of a 
+ *           fixedStep block has the same span.  A new block starts after 
+ *           each window left out.
+ *
+ * @param track The genome, with its blocks counted.
+ */
+void writeTrack(TrackRecord& track) {
+    std::string_view name = recordName(track.record.desc);
+    BigInt total = track.firstBase.back();
+    BigInt g = track.blockBases;
+    // The part of each window its fraction is written over
+    BigInt span = std::min(gcStep, gcWindow);
+    BigInt centre = (gcWindow - span) / 2;
+    std::string text;
+    bool inBlock = false;
+    for (BigInt start = 0; start + centre < total; start += gcStep) {
+        BigInt end = std::min(total, start + gcWindow);
+        if (gcTrack == "wig" && end - start < gcWindow) {
+            break;
+        }
+        BigInt gc = 0, acgt = 0;
+        for (BigInt b = start / g; b < (end + g - 1) / g; b++) {
+            gc += track.gc[b];
+            acgt += track.acgt[b];
+        }
+        if (acgt == 0) {
+            inBlock = false;
+            continue;
+        }
+        if (gcTrack == "wig") {
+            if (!inBlock) {
+                text += "fixedStep chrom=";
+                text += name;
+                text += " start=";
+                appendInt(text, start + centre + 1);
+                text += " step=";
+                appendInt(text, gcStep);
+                text += " span=";
+                appendInt(text, span);
+                text += '\n';
+                inBlock = true;
+            }
+        } else {
+            text += name;
+            text += '\t';
+            appendInt(text, start + centre);
+            text += '\t';
+            appendInt(text, std::min(total, start + centre + span));
+            text += '\t';
+        }
+        appendFixed(text, static_cast<double>(gc) / acgt);
+        text += '\n';
+        if (text.size() >= OutputThread::OUTPUT_BUFFER) {
+            writer->put(track.record.seq, text, false);
+            text.clear();
+        }
+    }
+    writer->put(track.record.seq, text);
+    track.gc.reset();
+    track.acgt.reset();
+}  // End of the 'writeTrack' function
+
+/**
+ * This is the task that counts the blocks of one piece of a genome for its 
+ * GC track.  The piece is walked a line at a time to find where each block 
+ * ends, and each block's bytes are counted with the counting kernel, line 
+ * endings and all, since the kernel skips them.  The task that finishes the 
+ * last piece writes the track.
+ *
+ * @param track The genome, with the base each piece starts at.
+ * @param p The index of the piece within the genome.
+ * @param mem The char array that contains the FASTA file.
+ */
+void countTrackPiece(TrackRecord& track, BigInt p, const char* mem) {
+    const Record& record = track.record;
+    BigInt start = record.pieceStart(p);
+    BigInt end = record.pieceEnd(p);
+    BigInt g = track.blockBases;
+    BigInt numBlocks = (track.firstBase.back() + g - 1) / g;
+    BigInt base = track.firstBase[p];
+    BigInt block = base / g;
+    BigInt blockStart = start;
+    auto addBlock = [&](BigInt to) {
+        if (block < numBlocks && blockStart < to) {
+            Counts counts;
+            countKernel(mem + blockStart, to - blockStart, counts);
+            // G & C, then A & T
+            BigInt gc = counts.both(0) + counts.both(1);
+            track.gc[block] += gc;
+            track.acgt[block] += gc + counts.both(2) + counts.both(3);
+        }
+    };
+    BigInt pos = start;
+    while (pos < end) {
+        const void* nl = memchr(mem + pos, '\n', end - pos);
+        BigInt lineEnd = (nl == NULL) ? end : 
+                         static_cast<const char*>(nl) - mem;
+        BigInt lineBases = lineEnd - pos - std::count(mem + pos, 
+                                                      mem + lineEnd, '\r');
+        // Close every block that ends in this line
+        while (base + lineBases >= (block + 1) * g) {
+            BigInt n = (block + 1) * g - base;
+            BigInt at = skipBases(mem, pos, n);
+            addBlock(at);
+            lineBases -= n;
+            base += n;
+            pos = blockStart = at;
+            block++;
+        }
+        base += lineBases;
+        pos = (nl == NULL) ? end : lineEnd + 1;
+    }
+    addBlock(end);
+    if (--track.remaining == 0) {
+        writeTrack(track);
+    }
+}  // End of the 'countTrackPiece' function
+
+/**
+ * This is a helper function that will stage the tasks for making the GC 
+ * track of each genome, the way 'stageCollections' does for the stats.  The 
+ * pieces of a genome count their bases first, and the last one to finish 
+ * stages the pieces again to count the blocks, so the windows come out in 
+ * sequence coordinates however the lines are wrapped.
+ *
+ * @param file The mmaped file, with its indicies found.
+ */
+void stageTrack(OpenFile& file) {
+    std::cout << "Making the GC track...\n";
+    const char* mem = file.mem;
+    // The windows are made of blocks that evenly divide the window and step
+    BigInt g = gcWindow;
+    for (BigInt step = gcStep; step != 0; ) {
+        BigInt rest = g % step;
+        g = step;
+        step = rest;
+    }
+    findRecords(file);
+    for (const Record& found : file.records) {
+        file.tracks.emplace_back();
+        TrackRecord& track = file.tracks.back();
+        Record& record = track.record;
+        record = found;
+        record.seq = writer->reserve();
+        track.blockBases = g;
+        track.firstBase.assign(record.numPieces + 1, 0);
+        track.remaining = record.numPieces;
+        TrackRecord* tp = &track;
+        TaskGroup* group = &file.group;
+        for (BigInt p = 0; p < record.numPieces; p++) {
+            pool->submit(file.group, [tp, p, mem, group] {
+                const Record& record = tp->record;
+                BigInt start = record.pieceStart(p);
+                BigInt end = record.pieceEnd(p);
+                Counts counts;
+                countKernel(mem + start, end - start, counts);
+                tp->firstBase[p + 1] = counts.total() + counts.invalid;
+                if (--tp->remaining > 0) {
+                    return;
+                }
+                // Every piece knows its bases now, so count the blocks
+                for (BigInt q = 0; q < record.numPieces; q++) {
+                    tp->firstBase[q + 1] += tp->firstBase[q];
+                }
+                BigInt numBlocks = (tp->firstBase.back() + tp->blockBases - 1) / 
+                                   tp->blockBases;
+                tp->gc.reset(new std::atomic<BigInt>[numBlocks]());
+                tp->acgt.reset(new std::atomic<BigInt>[numBlocks]());
+                tp->remaining = record.numPieces;
+                for (BigInt q = 0; q < record.numPieces; q++) {
+                    pool->submit(*group, [tp, q, mem] {
+                        countTrackPiece(*tp, q, mem);
+                    });
+                }
+            });
+        }
+    }
+}  // End of the 'stageTrack' function
+
+/**
+ * This is a helper function that will find the runs that start in one piece 
+ * of a genome, with the given kernel.  A run still going at the end of the 
+ * piece is followed into the pieces after it until it ends, and a run going 
+ * at the start of the piece is left to the piece it started in, so every run 
+ * is found whole by exactly one piece and nothing has to be joined.  Gaps 
+ * shorter than --min-gap are dropped here.
+ *
+ * @param record The genome.
+ * @param p The index of the piece within the genome.
+ * @param mem The char array that contains the FASTA file.
+ * @param kernel The run kernel to search with.
+ * @param found The base each run starts at, then the one after it ends, 
+ *              from the start of the piece.
+ * @returns The number of bases in the piece.
+ */
+BigInt scanRunPiece(const Record& record, BigInt p, const char* mem, 
+                    RunKernel kernel, BigIVec& found) {
+    const BigInt FOLLOW = 65536;  // Bytes searched at a time past the piece
+    BigInt start = record.pieceStart(p);
+    BigInt end = record.pieceEnd(p);
+    // A run at base 0 started in the piece before if the last base before 
+    // the piece is in a run too
+    bool before = false;
+    if (p > 0) {
+        BigInt i = start - 1;
+        while (i >= record.ending && (mem[i] == '\n' || mem[i] == '\r')) {
+            i--;
+        }
+        before = i >= record.ending && (softMask ? inRunClass<true>(mem[i]) : 
+                                                   inRunClass<false>(mem[i]));
+    }
+    RunScan scan;
+    kernel(mem, start, end, scan);
+    BigInt bases = scan.base;
+    BigInt first = (before && !scan.runs.empty() && scan.runs[0] == 0) ? 2 : 0;
+    BigInt open = scan.runs.size();
+    if (scan.inRun && open > first) {
+        for (BigInt at = end; scan.runs.size() == open && at < record.end; 
+             at += FOLLOW) {
+            kernel(mem, at, std::min(record.end, at + FOLLOW), scan);
+        }
+        if (scan.runs.size() == open) {
+            scan.runs.push_back(scan.base);
+        }
+        // Drop what was found past the end of the run being followed
+        scan.runs.resize(open + 1);
+    } else if (scan.inRun) {
+        scan.runs.push_back(scan.base);
+    }
+    found.clear();
+    for (BigInt r = first; r < scan.runs.size(); r += 2) {
+        if (scan.runs[r + 1] - scan.runs[r] >= minGap) {
+            found.push_back(scan.runs[r]);
+            found.push_back(scan.runs[r + 1]);
+        }
+    }
+    return bases;
+}  // End of the 'scanRunPiece' function
+
+/**
+ * This is the function that will hand the runs of one piece of a genome to 
+ * the writer as BED: the genome's name, the base the run starts at and the 
+ * base after it ends, counted from 0 without line endings.  The text goes 
+ * over in parts as it fills a buffer, so a piece with a great many runs 
+ * doesn't have to be held whole.
+ *
+ * @param runs The genome.
+ * @param p The index of the piece within the genome.
+ * @param first The base the piece starts at.
+ * @param text A buffer to format the text in.
+ */
+void writeRunPiece(RunRecord& runs, BigInt p, BigInt first, 
+                   std::string& text) {
+    std::string_view name = recordName(runs.record.desc);
+    const BigIVec& found = runs.found[p];
+    for (BigInt r = 0; r < found.size(); r += 2) {
+        text += name;
+        text += '\t';
+        appendInt(text, first + found[r]);
+        text += '\t';
+        appendInt(text, first + found[r + 1]);
+        text += '\n';
+        if (text.size() >= OutputThread::OUTPUT_BUFFER) {
+            writer->put(runs.record.seq, text, false);
+            text.clear();
+        }
+    }
+    writer->put(runs.record.seq, text, p + 1 == runs.record.numPieces);
+    text.clear();
+    BigIVec().swap(runs.found[p]);
+    {  // Critical section
+    std::lock_guard<std::mutex> lock(runLock);
+    runPieces--;
+    }
+    runRoom.notify_all();
+}  // End of the 'writeRunPiece' function
+
+/**
+ * This is the task that searches one piece of a genome for runs with the 
+ * kernel picked in 'selectKernel'.  Then the pieces that have been searched 
+ * with all of the pieces before them are written in order, by whichever 
+ * task isn't already writing the genome's pieces.
+ *
+ * @param runs The genome.
+ * @param p The index of the piece within the genome.
+ * @param mem The char array that contains the FASTA file.
+ */
+void findRunPiece(RunRecord& runs, BigInt p, const char* mem) {
+    const Record& record = runs.record;
+    runs.bases[p] = scanRunPiece(record, p, mem, runKernel, runs.found[p]);
+    if (verifyCounts) {
+        BigIVec check;
+        BigInt bases = scanRunPiece(record, p, mem, softMask ? 
+                                    runScalar<true> : runScalar<false>, check);
+        if (bases != runs.bases[p] || check != runs.found[p]) {
+            std::cerr << "Kernel runs do not match the scalar runs for " 
+                      << record.desc << std::endl;
+            exit(-1);
+        }
+    }
+    std::unique_lock<std::mutex> lock(runs.lock);
+    runs.searched[p] = true;
+    if (runs.writing) {
+        return;
+    }
+    runs.writing = true;
+    std::string text;
+    while (runs.written < record.numPieces && runs.searched[runs.written]) {
+        BigInt q = runs.written;
+        BigInt first = runs.firstBase;
+        lock.unlock();
+        writeRunPiece(runs, q, first, text);
+        lock.lock();
+        runs.firstBase += runs.bases[q];
+        runs.written++;
+    }
+    runs.writing = false;
+}  // End of the 'findRunPiece' function
+
+/**
+ * This is a helper function that will stage the tasks for finding the gaps, 
+ * or the soft-masked runs, in each genome, a task for each piece 
+ * 'findRecords' splits it into.  The runs a piece finds are held until it is 
+ * written, so only a few pieces for each thread are let be in flight at once.
+ *
+ * @param file The mmaped file, with its indicies found.
+ */
+void stageRuns(OpenFile& file) {
+    std::cout << (softMask ? "Finding soft-masked runs...\n" : 
+                             "Finding gaps...\n");
+    const BigInt RUN_PIECES = 2 * numThreads + 2;
+    const char* mem = file.mem;
+    findRecords(file);
+    for (const Record& found : file.records) {
+        file.runs.emplace_back();
+        RunRecord& runs = file.runs.back();
+        Record& record = runs.record;
+        record = found;
+        record.seq = writer->reserve();
+        runs.found.resize(record.numPieces);
+        runs.bases.resize(record.numPieces);
+        runs.searched.assign(record.numPieces, false);
+        RunRecord* rp = &runs;
+        for (BigInt p = 0; p < record.numPieces; p++) {
+            {  // Critical section
+            std::unique_lock<std::mutex> lock(runLock);
+            runRoom.wait(lock, [&] { return runPieces < RUN_PIECES; });
+            runPieces++;
+            }
+            pool->submit(file.group, [rp, p, mem] {
+                findRunPiece(*rp, p, mem);
+            });
+        }
+    }
+}  // End of the 'stageRuns' function
+
+// Each thread's k-mers are split over this many tables by their hash, so the 
+// tables can be merged in parallel, one partition per task
+const int KMER_PART_BITS = 6;
+const int KMER_PARTS = 1 << KMER_PART_BITS;
+
+/**
+ * These are the hash functions for the k-mer tables.  The top bits pick the 
+ * partition and the low bits the slot.
+ *
+ * @param key The 2-bit packed k-mer.
+ * @returns The hash.
+ */
+BigInt kmerHash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}  // End of the 'kmerHash' function
+
+BigInt kmerHash(unsigned __int128 key) {
+    return kmerHash(static_cast<uint64_t>(key) ^ 
+                    kmerHash(static_cast<uint64_t>(key >> 64)));
+}  // End of the 'kmerHash' function
+
+/**
+ * This is an open addressing hash table from k-mers to their counts.  The 
+ * k-mers are packed 2 bits a base into 'Key', a uint64_t up to k = 31 and an 
+ * unsigned __int128 up to k = 63, so a key of all ones is never a k-mer and 
+ * marks an empty slot.
+ */
+template <typename Key>
+class KmerTable {
+public:
+    static constexpr Key EMPTY = ~Key(0);
+
+    /**
+     * This is the function that will add to the count of a k-mer.
+     *
+     * @param key The k-mer.
+     * @param hash The hash of the k-mer.
+     * @param n The count to add.
+     */
+    void add(Key key, BigInt hash, BigInt n) {
+        if ((used + 1) * 2 > keys.size()) {
+            grow();
+        }
+        BigInt mask = keys.size() - 1;
+        for (BigInt i = hash & mask; ; i = (i + 1) & mask) {
+            if (keys[i] == EMPTY) {
+                keys[i] = key;
+                counts[i] = n;
+                used++;
+                return;
+            }
+            if (keys[i] == key) {
+                counts[i] += n;
+                return;
+            }
+        }
+    }  // End of the 'add' function
+
+    /**
+     * This is the function that will call 'fn' with every k-mer in the table 
+     * and its count.
+     */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (BigInt i = 0; i < keys.size(); i++) {
+            if (keys[i] != EMPTY) {
+                fn(keys[i], counts[i]);
+            }
+        }
+    }  // End of the 'forEach' function
+
+private:
+    /**
+     * This is a helper function that will double the table, or start it.
+     */
+    void grow() {
+        std::vector<Key> oldKeys(std::max<BigInt>(1024, keys.size() * 2), 
+                                 EMPTY);
+        std::vector<BigInt> oldCounts(oldKeys.size());
+        keys.swap(oldKeys);
+        counts.swap(oldCounts);
+        used = 0;
+        for (BigInt i = 0; i < oldKeys.size(); i++) {
+            if (oldKeys[i] != EMPTY) {
+                add(oldKeys[i], kmerHash(oldKeys[i]), oldCounts[i]);
+            }
+        }
+    }  // End of the 'grow' function
+
+    std::vector<Key> keys;
+    std::vector<BigInt> counts;
+    BigInt used = 0;
+};  // End of the 'KmerTable' class
+
+/**
+ * This is a struct to hold the k-mer tables of every thread that counts 
+ * k-mers, so no table is shared while counting.  Each thread makes its own 
+ * the first time it counts, and they are all merged once every file is read.
+ */
+template <typename Key>
+struct KmerTables {
+    using Shard = std::vector<KmerTable<Key>>;  // One thread's partitions
+
+    static inline std::mutex lock;  // Guards 'shards'
+    static inline std::vector<std::unique_ptr<Shard>> shards;
+
+    /**
+     * @returns This thread's partitions.
+     */
+    static Shard& local() {
+        thread_local Shard* shard = NULL;
+        if (shard == NULL) {
+            std::lock_guard<std::mutex> guard(lock);
+            shards.emplace_back(new Shard(KMER_PARTS));
+            shard = shards.back().get();
+        }
+        return *shard;
+    }  // End of the 'local' function
+};  // End of the 'KmerTables' struct
+
+/**
+ * This is the task that counts the k-mers that start in one piece of a 
+ * genome.  The bases are rolled into the k-mer and its reverse complement 2 
+ * bits at a time.  It reads up to k - 1 bases past the end of the piece to 
+ * finish the k-mers that start in it, and the piece after it starts over.
+ *
+ * @param record The genome.
+ * @param p The index of the piece within the genome.
+ * @param mem The char array that contains the FASTA file.
+ */
+template <typename Key>
+void countKmerPiece(const Record& record, BigInt p, const char* mem) {
+    typename KmerTables<Key>::Shard& shard = KmerTables<Key>::local();
+    const int k = kmerSize;
+    const Key mask = (Key(1) << (2 * k)) - 1;
+    const int shift = 2 * (k - 1);
+    BigInt start = record.pieceStart(p);
+    BigInt end = record.pieceEnd(p);
+    Key forward = 0, reverse = 0;
+    int run = 0;       // Bases in a row, up to k
+    int past = 0;      // Bases read past the end of the piece
+    for (BigInt pos = start; pos < record.end; pos++) {
+        unsigned char code = BASE_CODES.code[static_cast<unsigned char>(mem[pos])];
+        if (code == BASE_SKIP) {
+            continue;
+        }
+        if (pos >= end && (code == BASE_BREAK || ++past == k)) {
+            break;
+        }
+        if (code == BASE_BREAK) {
+            run = 0;
+            continue;
+        }
+        forward = ((forward << 2) | code) & mask;
+        reverse = (reverse >> 2) | (Key(3 - code) << shift);
+        if (run < k) run++;
+        if (run == k) {
+            Key key = (canonicalKmers && reverse < forward) ? reverse : forward;
+            BigInt hash = kmerHash(key);
+            shard[hash >> (64 - KMER_PART_BITS)].add(key, hash, 1);
+        }
+    }
+}  // End of the 'countKmerPiece' function
+
+/**
+ * This is a helper function that will stage the tasks for counting the 
+ * k-mers in each genome, a task for each piece 'findRecords' splits it into.
+ *
+ * @param file The mmaped file, with its indicies found.
+ */
+void stageKmers(OpenFile& file) {
+    std::cout << "Counting k-mers...\n";
+    const char* mem = file.mem;
+    findRecords(file);
+    for (const Record& record : file.records) {
+        const Record* rp = &record;
+        for (BigInt p = 0; p < record.numPieces; p++) {
+            pool->submit(file.group, [rp, p, mem] {
+                if (kmerSize <= 31) {
+                    countKmerPiece<uint64_t>(*rp, p, mem);
+                } else {
+                    countKmerPiece<unsigned __int128>(*rp, p, mem);
+                }
+            });
+        }
+    }
+}  // End of the 'stageKmers' function
+
+/**
+ * This is the function that will merge the k-mer tables of every thread, one 
+ * partition per task, and write the histogram: how many distinct k-mers were 
+ * seen each number of times.  With --kmer-dump, every k-mer and its count is 
+ * written there too, a partition at a time.
+ */
+template <typename Key>
+void writeKmers() {
+    std::cout << "Merging k-mers...\n";
+    auto& shards = KmerTables<Key>::shards;
+    std::unique_ptr<OutputThread> dumpOutput;
+    std::unique_ptr<OrderedWriter> dumpWriter;
+    int dfd = -1;
+    if (!kmerDump.empty()) {
+        dfd = open(kmerDump.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (dfd < 0) {
+            throw std::runtime_error("Could not open " + kmerDump);
+        }
+        dumpOutput.reset(new OutputThread(dfd));
+        dumpWriter.reset(new OrderedWriter(*dumpOutput, KMER_PARTS));
+    }
+    std::vector<std::map<BigInt, BigInt>> histograms(KMER_PARTS);
+    TaskGroup group;
+    for (int p = 0; p < KMER_PARTS && !shards.empty(); p++) {
+        BigInt seq = dumpWriter ? dumpWriter->reserve() : 0;
+        OrderedWriter* dump = dumpWriter.get();
+        pool->submit(group, [p, seq, dump, &shards, &histograms] {
+            KmerTable<Key> merged = std::move((*shards[0])[p]);
+            for (BigInt s = 1; s < shards.size(); s++) {
+                (*shards[s])[p].forEach([&merged](Key key, BigInt n) {
+                    merged.add(key, kmerHash(key), n);
+                });
+                (*shards[s])[p] = KmerTable<Key>();
+            }
+            std::map<BigInt, BigInt>& histogram = histograms[p];
+            std::string text;
+            merged.forEach([&histogram, &text, dump](Key key, BigInt n) {
+                histogram[n]++;
+                if (dump != NULL) {
+                    for (int b = kmerSize - 1; b >= 0; b--) {
+                        text += "ACGT"[static_cast<int>(key >> (2 * b)) & 3];
+                    }
+                    text += '\t';
+                    appendInt(text, n);
+                    text += '\n';
+                }
+            });
+            if (dump != NULL) {
+                dump->put(seq, text);
+            }
+        });
+    }
+    pool->wait(group);
+    shards.clear();
+
+    std::map<BigInt, BigInt> histogram;
+    for (auto& part : histograms) {
+        for (auto& bin : part) {
+            histogram[bin.first] += bin.second;
+        }
+    }
+    std::string text;
+    for (auto& bin : histogram) {
+        appendInt(text, bin.first);
+        text += '\t';
+        appendInt(text, bin.second);
+        text += '\n';
+    }
+    writer->put(writer->reserve(), text);
+
+    if (dumpWriter) {
+        dumpWriter->flush();
+        bool written = dumpOutput->finish();
+        if (close(dfd) != 0 || !written) {
+            throw std::runtime_error("Could not write " + kmerDump);
+        }
+        std::cout << "K-mers are dumped in file named " << kmerDump 
+                  << std::endl;
+    }
+}  // End of the 'writeKmers' function
+
+/**
+ * This is a helper function for each chunk task to execute.  It will check 
+ * for indecies where a new genome starts, which is a '>' at the start of a 
+ * line.  Then it will append them to the chunk's own vector, so no lock is 
+ * needed and they come out in order.  With --advise=prefetch the chunk is 
+ * scanned a window at a time, prefetching the next window as it goes.
+ *
+ * @param found The vector for the indicies found in this chunk.
+ * @param start The beginning index of the file for this chunk to begin at.
+ * @param end The ending indes of the file for this chunk to end at.
+ * @param mem The char array that holds the contents of the FASTA file.
+ */
+void processChunks(BigIVec& found, BigInt start, BigInt end, const char* mem) {
+    if (!prefetch) {
+        scanKernel(mem, start, end, found);
+        return;
+    }
+    // Scan a window at a time, with the next one being read in meanwhile
+    prefetchRange(mem, start, std::min(end, start + PREFETCH_BYTES));
+    for (BigInt s = start; s < end; s += PREFETCH_BYTES) {
+        BigInt e = std::min(end, s + PREFETCH_BYTES);
+        prefetchRange(mem, e, std::min(end, e + PREFETCH_BYTES));
+        scanKernel(mem, s, e, found);
+    }
+}  // End of the 'processChunks' function
+
+/**
+ * This is a helper method to get all the start end endpoints of each 
+ * genome in the file.
+ *
+ * @param mem The FASTA file.
+ * @param size The size of the file.
+ *
+ * @returns A vector that contains all of the indicies.
+ */
+void getIndicies(BigIVec& indicies, const char* mem, BigInt size) {
+    // Find out the size of the chunk of the file each task gets
+    BigInt chunkSize = size / numThreads;
+
+    // Hand the chunks of the file to the thread pool
+    std::vector<BigIVec> found(numThreads);
+    TaskGroup group;
+    for (int chunk = 0; chunk < numThreads; chunk++) {
+        BigInt start = chunk * chunkSize;
+        BigInt end   = (chunk == (numThreads -1)) ? size : (start + chunkSize);
+        BigIVec& chunkFound = found[chunk];
+        pool->submit(group, [&chunkFound, start, end, mem] {
+            processChunks(chunkFound, start, end, mem);
+        });
+    }
+
+    // Block until all the chunks are finished
+    pool->wait(group);
+
+    // The chunks are disjoint and ascending, so joining them in chunk order 
+    // leaves the indicies sorted
+    BigInt count = 1;
+    for (auto& f : found) {
+        count += f.size();
+    }
+    indicies.reserve(count);
+    for (auto& f : found) {
+        indicies.insert(indicies.end(), f.begin(), f.end());
+    }
+    
+    // Include the end of the file
+    indicies.push_back(size);
+
+//    // TMP
+//    for (auto i : indicies) {
+//        std::cout << i << '\n';
+//    }
+}  // End of the 'getIndicies' function
+
+/**
+ * This is the function that will read the lines of a .fai file, if it is 
+ * newer than the file it indexes.
+ *
+ * @param path The path to the .fai file.
+ * @param sb The stats of the indexed file.
+ * @param entries The vector to fill with the lines.
+ * @returns False if the .fai is missing, stale or can't be parsed.
+ */
+bool parseIndex(const std::string& path, const struct stat& sb, 
+                std::vector<FaiEntry>& entries) {
+    struct stat ib;
+    if (stat(path.c_str(), &ib) != 0 || ib.st_mtime < sb.st_mtime) {
+        return false;
+    }
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        FaiEntry entry;
+        if (!(fields >> entry.name >> entry.length >> entry.offset 
+                     >> entry.lineBases >> entry.lineWidth)) {
+            return false;
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}  // End of the 'parseIndex' function
+
+/**
+ * This is a helper function that will work out how many bytes the bases of 
+ * a .fai line take up in the file, line endings included.
+ *
+ * @param entry The .fai line.
+ * @returns The number of bytes.
+ */
+BigInt indexedBytes(const FaiEntry& entry) {
+    if (entry.lineBases == 0) {
+        return 0;
+    }
+    return (entry.length / entry.lineBases) * entry.lineWidth + 
+           entry.length % entry.lineBases;
+}  // End of the 'indexedBytes' function
+
+/**
+ * This is a helper function that will check that the bases of a .fai line 
+ * are still laid out in the file the way it says: every line ends in a 
+ * line ending right where the line width puts it, no line starts a header 
+ * and the last line isn't cut short.  Only the ends of the lines are looked 
+ * at, so this is far less work than scanning the genome again.
+ *
+ * @param mem The char array that contains the FASTA file.
+ * @param size The size of the file.
+ * @param entry The .fai line.
+ * @returns False if the lines don't match the .fai.
+ */
+bool indexedLinesMatch(const char* mem, BigInt size, const FaiEntry& entry) {
+    if (entry.length == 0) {
+        return true;
+    }
+    if (entry.lineBases == 0 || entry.lineWidth <= entry.lineBases || 
+        entry.lineWidth > entry.lineBases + 2) {
+        return false;
+    }
+    BigInt lines = entry.length / entry.lineBases;
+    BigInt rest = entry.length % entry.lineBases;
+    BigInt line = entry.offset;
+    for (BigInt l = 0; l < lines; l++, line += entry.lineWidth) {
+        // A full line holds no header and only a line ending after its 
+        // bases, which only the last line can leave out at the end of file
+        BigInt end = line + entry.lineWidth;
+        if (line + entry.lineBases > size || mem[line] == '>') {
+            return false;
+        }
+        for (BigInt i = line + entry.lineBases; i < std::min(end, size); i++) {
+            if (mem[i] != '\r' && mem[i] != '\n') {
+                return false;
+            }
+        }
+        if ((l + 1 < lines || rest > 0) && 
+            (end > size || mem[end - 1] != '\n')) {
+            return false;
+        }
+    }
+    // The last line may be short, but can't be cut by a line ending
+    if (rest == 0) {
+        line -= entry.lineWidth;
+        rest = entry.lineBases;
+    }
+    if (line + rest > size || mem[line] == '>' || 
+        memchr(mem + line, '\n', rest) != NULL || 
+        memchr(mem + line, '\r', rest) != NULL) {
+        return false;
+    }
+    return true;
+}  // End of the 'indexedLinesMatch' function
+
+/**
+ * This is the function that will load the genome indicies from a .fai file 
+ * instead of scanning the FASTA file for them.  The .fai is only trusted if 
+ * it is newer than the FASTA file and every line of it still lines up with 
+ * the file: each offset must follow a header that starts with '>' and the 
+ * whole name, every line of each genome must be as long as the .fai says 
+ * with no header in it, and only blank lines can sit between the end of a 
+ * genome and the next header or the end of the file.  A .fai has no room for 
+ * the size of the file, so these catch an edit made within the same second.
+ *
+ * @param path The path to the .fai file.
+ * @param sb The stats of the FASTA file.
+ * @param indicies The vector to fill with the index of each genome.
+ * @param mem The char array that contains the FASTA file.
+ * @returns False if the .fai is missing, stale or doesn't match the file.
+ */
+bool readIndex(const std::string& path, const struct stat& sb, 
+               BigIVec& indicies, const char* mem) {
+    std::vector<FaiEntry> entries;
+    if (!parseIndex(path, sb, entries)) {
+        return false;
+    }
+    BigInt size = sb.st_size;
+    BigIVec found;
+    for (auto& entry : entries) {
+        // The offset must be the first byte after a header line
+        if (entry.offset < 2 || entry.offset > size || 
+            mem[entry.offset - 1] != '\n') {
+            return false;
+        }
+        const void* nl = memrchr(mem, '\n', entry.offset - 1);
+        BigInt start = (nl == NULL) ? 0 : 
+                       static_cast<const char*>(nl) - mem + 1;
+        // The name must be the whole first word, so 'chr1' isn't 'chr10'
+        if (mem[start] != '>' || 
+            (!found.empty() && start <= found.back()) || 
+            entry.name.size() > entry.offset - start - 2 || 
+            entry.name.compare(0, entry.name.size(), mem + start + 1, 
+                               entry.name.size()) != 0 || 
+            !isspace(static_cast<unsigned char>(
+                    mem[start + 1 + entry.name.size()]))) {
+            return false;
+        }
+        // And the genome must fit in the file, line by line
+        if (entry.offset + indexedBytes(entry) > size + 1 || 
+            !indexedLinesMatch(mem, size, entry)) {
+            return false;
+        }
+        found.push_back(start);
+    }
+    if (found.empty() && size > 0) {
+        return false;
+    }
+    // Only line endings and blank lines can follow each genome
+    for (size_t e = 0; e < entries.size(); e++) {
+        BigInt next = (e + 1 < found.size()) ? found[e + 1] : size;
+        for (BigInt i = entries[e].offset + indexedBytes(entries[e]); 
+             i < next; i++) {
+            if (!isspace(static_cast<unsigned char>(mem[i]))) {
+                return false;
+            }
+        }
+    }
+    indicies.swap(found);
+    indicies.push_back(size);
+    return true;
+}  // End of the 'readIndex' function
+
+/**
+ * This is the function that will write the .fai lines built while counting. 
+ * It goes to a temporary file that is renamed over the .fai, so nobody ever 
+ * sees half an index.  Nothing is written if a genome couldn't be indexed or 
+ * two genomes share a name, since samtools would reject the file.
+ *
+ * @param path The path to the .fai file.
+ * @param index The .fai lines, one for each genome.
+ */
+void writeIndex(const std::string& path, const std::vector<FaiEntry>& index) {
+    std::vector<std::string> names;
+    for (auto& entry : index) {
+        if (entry.name.empty()) {
+            std::cout << "Not writing " << path 
+                      << ": the line lengths aren't uniform\n";
+            return;
+        }
+        names.push_back(entry.name);
+    }
+    std::sort(names.begin(), names.end());
+    if (std::adjacent_find(names.begin(), names.end()) != names.end()) {
+        std::cout << "Not writing " << path << ": the names aren't unique\n";
+        return;
+    }
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp);
+    for (auto& entry : index) {
+        out << entry.name << '\t' << entry.length << '\t' << entry.offset 
+            << '\t' << entry.lineBases << '\t' << entry.lineWidth << '\n';
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "Could not write " << path << "\n";
+        unlink(tmp.c_str());
+        return;
+    }
+    std::cout << "Wrote index " << path << "\n";
+}  // End of the 'writeIndex' function
+
+// The signature at the start of a UCSC .2bit file, as a little endian word
+const uint32_t TWOBIT_SIGNATURE = 0x1A412743;
+
+// The index in 'RESIDUES' of each 2-bit code: T, C, A & G
+const int TWOBIT_RESIDUE[4] = {3, 1, 2, 0};
+
+/**
+ * This is a struct to read the words of a mmaped .2bit file, which may have 
+ * been written on a machine of either byte order.
+ */
+struct TwoBitFile {
+    const unsigned char* mem;
+    BigInt size;
+    bool swap;  // The file's byte order isn't this machine's
+
+    uint32_t word(BigInt at) const {
+        uint32_t value;
+        memcpy(&value, mem + at, 4);
+        return swap ? __builtin_bswap32(value) : value;
+    }
+
+    uint64_t longWord(BigInt at) const {
+        uint64_t value;
+        memcpy(&value, mem + at, 8);
+        return swap ? __builtin_bswap64(value) : value;
+    }
+};  // End of the 'TwoBitFile' struct
+
+/**
+ * This is a struct to hold where the parts of one sequence are in a .2bit 
+ * file.  The block lists are stored as every start followed by every size.
+ */
+struct TwoBitRecord {
+    std::string desc;  // '>' and the name, or the FASTA description of a cache
+    BigInt offset;     // Index of the record in the file
+    BigInt start;      // Index reported for it, the FASTA '>' for a cache
+    BigInt dnaSize;    // Number of bases
+    BigInt nCount;     // Number of N blocks
+    BigInt nBlocks;    // Index of the N block list
+    BigInt maskCount;  // Number of mask blocks
+    BigInt maskBlocks; // Index of the mask block list
+    BigInt dna;        // Index of the packed bases
+    BigInt seq;        // Sequence number for the ordered writer
+};  // End of the 'TwoBitRecord' struct
+
+/**
+ * This is a struct to hold where one genome of a .2bit cache came from in its 
+ * FASTA file, as kept in the cache's .idx.
+ */
+struct PackSource {
+    BigInt start;      // Index of the genome's '>'
+    BigInt end;        // Index the genome ended at
+    std::string desc;  // The description, read back from the FASTA file
+};  // End of the 'PackSource' struct
+
+/**
+ * This is the function that will read the .idx of a .2bit cache.  Its first 
+ * line holds the size and the nanosecond mtime the FASTA file had when the 
+ * cache was built, and the size of the cache, and they must all still match. 
+ * Then there is a line with the start and end of each genome, which must 
+ * cover the FASTA file, and each genome's description is read back from it.
+ *
+ * @param path The path to the .idx file.
+ * @param fd The FASTA file.
+ * @param sb The stats of the FASTA file.
+ * @param cb The stats of the .2bit cache.
+ * @param sources The vector to fill with the genomes.
+ * @returns False if the .idx is missing or doesn't match the files.
+ */
+bool readPackIndex(const std::string& path, int fd, const struct stat& sb, 
+                   const struct stat& cb, std::vector<PackSource>& sources) {
+    std::ifstream in(path);
+    BigInt size, packSize;
+    long long sec, nsec;
+    if (!(in >> size >> sec >> nsec >> packSize) || 
+        size != static_cast<BigInt>(sb.st_size) || 
+        sec != sb.st_mtim.tv_sec || nsec != sb.st_mtim.tv_nsec || 
+        packSize != static_cast<BigInt>(cb.st_size)) {
+        return false;
+    }
+    PackSource source;
+    while (in >> source.start >> source.end) {
+        if ((!sources.empty() && source.start != sources.back().end) || 
+            source.end <= source.start || source.end > size) {
+            return false;
+        }
+        // The description runs to the end of the line, like 'getDescription'
+        source.desc.clear();
+        char buffer[4096];
+        for (BigInt at = source.start; at < source.end; ) {
+            ssize_t got = pread(fd, buffer, std::min<BigInt>(sizeof(buffer), 
+                                source.end - at), at);
+            if (got <= 0) {
+                return false;
+            }
+            const char* nl = static_cast<const char*>(
+                    memchr(buffer, '\n', got));
+            source.desc.append(buffer, (nl == NULL) ? got : nl - buffer);
+            if (nl != NULL) {
+                break;
+            }
+            at += got;
+        }
+        if (source.desc[0] != '>') {
+            return false;
+        }
+        sources.push_back(source);
+    }
+    return in.eof() && !sources.empty() && sources.back().end == size;
+}  // End of the 'readPackIndex' function
+
+/**
+ * This is a helper function that will count the 2-bit codes of a range of 
+ * packed bases.  The whole words are left to the kernel, and the bases on 
+ * either side of them are counted one at a time.
+ *
+ * @param dna The packed bases, four to a byte with the first in the top bits.
+ * @param start The first base to count.
+ * @param end One past the last base to count.
+ * @param codes The counts to add to, by code.
+ */
+void countPacked(const unsigned char* dna, BigInt start, BigInt end, 
+                 BigInt* codes) {
+    BigInt i = start;
+    for (; i < end && i % 32 != 0; i++) {
+        codes[(dna[i / 4] >> (6 - 2 * (i % 4))) & 3]++;
+    }
+    BigInt words = (end - i) / 32;
+    packedKernel(dna + i / 4, words, codes);
+    i += words * 32;
+    for (; i < end; i++) {
+        codes[(dna[i / 4] >> (6 - 2 * (i % 4))) & 3]++;
+    }
+}  // End of the 'countPacked' function
+
+/**
+ * This is a helper function that will count the dinucleotides of a .2bit 
+ * sequence from its packed bases.  The pairs are counted between the N 
+ * blocks, so none of them has an N in it.
+ *
+ * @param tb The .2bit file.
+ * @param record The sequence.
+ * @param pairs The 16 counts to add to, in 'PAIR_BASES' order.
+ */
+void pairsTwoBit(const TwoBitFile& tb, const TwoBitRecord& record, 
+                 BigInt* pairs) {
+    // The index in 'PAIR_BASES' of each 2-bit code: T, C, A & G
+    static const int PAIR_CODE[4] = {3, 1, 0, 2};
+    const unsigned char* dna = tb.mem + record.dna;
+    BigInt from = 0;
+    for (BigInt b = 0; b <= record.nCount; b++) {
+        // The bases from the end of the last N block to the start of this one
+        BigInt to = record.dnaSize, next = record.dnaSize;
+        if (b < record.nCount) {
+            to = tb.word(record.nBlocks + 4 * b);
+            next = to + tb.word(record.nBlocks + 4 * (record.nCount + b));
+        }
+        if (from < to) {
+            int x = PAIR_CODE[(dna[from / 4] >> (6 - 2 * (from % 4))) & 3];
+            for (BigInt i = from + 1; i < to; i++) {
+                int y = PAIR_CODE[(dna[i / 4] >> (6 - 2 * (i % 4))) & 3];
+                pairs[x * 4 + y]++;
+                x = y;
+            }
+        }
+        from = std::max(from, next);
+    }
+}  // End of the 'pairsTwoBit' function
+
+/**
+ * This is the task that counts one sequence of a .2bit file.  The packed 
+ * bases are counted as a whole, then the bases under the N blocks are taken 
+ * back out and counted as N.  The bases under the mask blocks, less the ones 
+ * that are also N, are moved to the lower case counts.
+ *
+ * @param tb The .2bit file.
+ * @param record The sequence.
+ * @param counts The counts to fill in.
+ */
+void countTwoBit(const TwoBitFile& tb, const TwoBitRecord& record, 
+                 Counts& counts) {
+    const unsigned char* dna = tb.mem + record.dna;
+    BigInt all[4] = {}, inN[4] = {}, inMask[4] = {}, inBoth[4] = {};
+    countPacked(dna, 0, record.dnaSize, all);
+    BigInt nBases = 0, bothBases = 0;
+    for (BigInt b = 0; b < record.nCount; b++) {
+        BigInt start = tb.word(record.nBlocks + 4 * b);
+        BigInt len = tb.word(record.nBlocks + 4 * (record.nCount + b));
+        countPacked(dna, start, start + len, inN);
+        nBases += len;
+    }
+    // Walk the N and mask lists together to find where they overlap
+    BigInt n = 0;
+    for (BigInt b = 0; b < record.maskCount; b++) {
+        BigInt start = tb.word(record.maskBlocks + 4 * b);
+        BigInt end = start + tb.word(record.maskBlocks + 
+                                     4 * (record.maskCount + b));
+        countPacked(dna, start, end, inMask);
+        while (n < record.nCount && 
+               tb.word(record.nBlocks + 4 * n) + 
+               tb.word(record.nBlocks + 4 * (record.nCount + n)) <= start) {
+            n++;
+        }
+        for (BigInt o = n; o < record.nCount; o++) {
+            BigInt nStart = tb.word(record.nBlocks + 4 * o);
+            if (nStart >= end) break;
+            BigInt nEnd = nStart + tb.word(record.nBlocks + 
+                                           4 * (record.nCount + o));
+            BigInt from = std::max(start, nStart), to = std::min(end, nEnd);
+            countPacked(dna, from, to, inBoth);
+            bothBases += to - from;
+        }
+    }
+    for (int c = 0; c < 4; c++) {
+        int r = TWOBIT_RESIDUE[c];
+        counts.lower[r] = inMask[c] - inBoth[c];
+        counts.upper[r] = all[c] - inN[c] - counts.lower[r];
+    }
+    counts.lower[4] = bothBases;
+    counts.upper[4] = nBases - bothBases;
+    if (countPairs) {
+        pairsTwoBit(tb, record, counts.pairs);
+    }
+}  // End of the 'countTwoBit' function
+
+/**
+ * This is a helper function that will check a block list of a .2bit record: 
+ * it must fit in the file, and its blocks must be in order, apart from each 
+ * other and inside the sequence.
+ *
+ * @param tb The .2bit file.
+ * @param at The index of the list.
+ * @param count The number of blocks.
+ * @param dnaSize The number of bases in the sequence.
+ * @returns False if the list is malformed.
+ */
+bool checkBlocks(const TwoBitFile& tb, BigInt at, BigInt count, 
+                 BigInt dnaSize) {
+    if (at + 8 * count > tb.size) {
+        return false;
+    }
+    BigInt last = 0;
+    for (BigInt b = 0; b < count; b++) {
+        BigInt start = tb.word(at + 4 * b);
+        BigInt end = start + tb.word(at + 4 * (count + b));
+        if (start < last || end > dnaSize) {
+            return false;
+        }
+        last = end;
+    }
+    return true;
+}  // End of the 'checkBlocks' function
+
+/**
+ * This is the function that will count the sequences of a mmaped UCSC .2bit 
+ * file, one task each.  Every record is checked before any task starts, so a 
+ * malformed file is turned down as a whole.  For the .2bit cache of a FASTA 
+ * file, each record must also match its genome in the FASTA file, and is 
+ * reported with that genome's description and offset.
+ *
+ * @param mem The mmaped file.
+ * @param size The size of the file.
+ * @param fileIndex The index of the file in the list of inputs.
+ * @param sources The genomes of the FASTA file for a cache, or NULL.
+ * @returns False if the file is malformed, or doesn't match 'sources'.
+ */
+bool readTwoBit(const char* mem, BigInt size, BigInt fileIndex, 
+                const std::vector<PackSource>* sources) {
+    TwoBitFile tb;
+    tb.mem = reinterpret_cast<const unsigned char*>(mem);
+    tb.size = size;
+    tb.swap = false;
+    if (size < 16) {
+        return false;
+    }
+    tb.swap = tb.word(0) != TWOBIT_SIGNATURE;
+    uint32_t version = tb.word(4);
+    if (tb.word(0) != TWOBIT_SIGNATURE || version > 1) {
+        return false;
+    }
+    BigInt offsetSize = (version == 1) ? 8 : 4;
+
+    // Read the index, then each record's header
+    // Every index entry takes at least 5 bytes
+    if (tb.word(8) > (size - 16) / 5) {
+        return false;
+    }
+    std::vector<TwoBitRecord> records(tb.word(8));
+    if (sources != NULL && sources->size() != records.size()) {
+        return false;
+    }
+    BigInt at = 16;
+    for (auto& record : records) {
+        if (at >= size || at + 1 + tb.mem[at] + offsetSize > size) {
+            return false;
+        }
+        BigInt nameSize = tb.mem[at];
+        record.desc = ">" + std::string(mem + at + 1, nameSize);
+        at += 1 + nameSize;
+        record.offset = (version == 1) ? tb.longWord(at) : tb.word(at);
+        record.start = record.offset;
+        at += offsetSize;
+
+        BigInt r = record.offset;
+        if (r + 8 > size) {
+            return false;
+        }
+        record.dnaSize = tb.word(r);
+        record.nCount = tb.word(r + 4);
+        record.nBlocks = r + 8;
+        BigInt m = record.nBlocks + 8 * record.nCount;
+        if (!checkBlocks(tb, record.nBlocks, record.nCount, record.dnaSize) || 
+            m + 4 > size) {
+            return false;
+        }
+        record.maskCount = tb.word(m);
+        record.maskBlocks = m + 4;
+        record.dna = record.maskBlocks + 8 * record.maskCount + 4;
+        if (!checkBlocks(tb, record.maskBlocks, record.maskCount, 
+                         record.dnaSize) || 
+            record.dna + (record.dnaSize + 3) / 4 > size) {
+            return false;
+        }
+
+        // A cache's record must be named for its genome, and its bases must 
+        // fit in the genome's lines
+        if (sources != NULL) {
+            const PackSource& source = (*sources)[&record - &records[0]];
+            BigInt lines = source.end - source.start - source.desc.size();
+            if (record.desc.compare(1, std::string::npos, 
+                                    recordName(source.desc)) != 0 || 
+                record.dnaSize > lines) {
+                return false;
+            }
+            record.desc = source.desc;
+            record.start = source.start;
+        }
+    }
+
+    std::cout << "Counting nucleotides from a .2bit file...\n";
+    TaskGroup group;
+    for (auto& record : records) {
+        if (!wantRecord(record.desc)) {
+            continue;
+        }
+        record.seq = writer->reserve();
+        const TwoBitRecord* rp = &record;
+        pool->submit(group, [&tb, rp, fileIndex] {
+            Counts counts;
+            countTwoBit(tb, *rp, counts);
+            writeStats(rp->seq, rp->desc, fileIndex, rp->start, counts);
+        });
+    }
+    pool->wait(group);
+    std::cout << "Done counting nucleotides...\n";
+    return true;
+}  // End of the 'readTwoBit' function
+
+/**
+ * This is a struct to hold one genome of a FASTA file packed into 2-bit 
+ * codes, ready to be written to a .2bit cache.
+ */
+struct PackedRecord {
+    std::string name;                  // The name, the description's first word
+    BigInt dnaSize = 0;                // Number of bases
+    std::vector<unsigned char> dna;    // The packed bases
+    std::vector<uint32_t> nBlocks;     // Every start, then every size
+    std::vector<uint32_t> maskBlocks;  // Every start, then every size
+    bool ok = true;                    // False if it can't be packed
+};  // End of the 'PackedRecord' struct
+
+/**
+ * This is a helper function that will add a base to a run of blocks, 
+ * starting a new block if it doesn't follow on from the last one.
+ *
+ * @param starts The starts of the blocks.
+ * @param sizes The sizes of the blocks.
+ * @param base The index of the base.
+ */
+void extendBlock(std::vector<uint32_t>& starts, std::vector<uint32_t>& sizes,
+                 BigInt base) {
+    if (!starts.empty() && starts.back() + sizes.back() == base) {
+        sizes.back()++;
+    } else {
+        starts.push_back(base);
+        sizes.push_back(1);
+    }
+}  // End of the 'extendBlock' function
+
+/**
+ * This is the task that packs one genome of a FASTA file.  Only A, C, G, T 
+ * and N in either case fit in a .2bit file, so anything else marks the 
+ * genome as one that can't be packed.  N is stored as T under an N block, 
+ * and lower case bases are put under mask blocks.
+ *
+ * @param record The genome.
+ * @param mem The char array that contains the FASTA file.
+ * @param packed The packed genome to fill in.
+ */
+void packRecord(const Record& record, const char* mem, PackedRecord& packed) {
+    static const signed char CODE[4] = {'T', 'C', 'A', 'G'};
+    signed char code[256];
+    memset(code, -1, sizeof(code));
+    for (int c = 0; c < 4; c++) {
+        code[static_cast<unsigned char>(CODE[c])] = c;
+        code[static_cast<unsigned char>(CODE[c] | 0x20)] = c;
+    }
+    code['N'] = code['n'] = 0;
+
+    packed.name = std::string(recordName(record.desc));
+    std::vector<uint32_t> nStarts, nSizes, maskStarts, maskSizes;
+    BigInt base = 0;
+    unsigned char byte = 0;
+    for (BigInt i = record.ending; i < record.end; i++) {
+        unsigned char ch = mem[i];
+        if (ch == '\n' || ch == '\r') {
+            continue;
+        }
+        if (code[ch] < 0 || base >= UINT32_MAX) {
+            packed.ok = false;
+            return;
+        }
+        if ((ch | 0x20) == 'n') {
+            extendBlock(nStarts, nSizes, base);
+        }
+        if (ch & 0x20) {
+            extendBlock(maskStarts, maskSizes, base);
+        }
+        byte = (byte << 2) | code[ch];
+        if (++base % 4 == 0) {
+            packed.dna.push_back(byte);
+            byte = 0;
+        }
+    }
+    if (base % 4 != 0) {
+        packed.dna.push_back(byte << (2 * (4 - base % 4)));
+    }
+    packed.dnaSize = base;
+    packed.nBlocks = nStarts;
+    packed.nBlocks.insert(packed.nBlocks.end(), nSizes.begin(), nSizes.end());
+    packed.maskBlocks = maskStarts;
+    packed.maskBlocks.insert(packed.maskBlocks.end(), maskSizes.begin(), 
+                             maskSizes.end());
+}  // End of the 'packRecord' function
+
+/**
+ * This is the function that will write a .2bit cache of a FASTA file once it 
+ * has been counted.  The genomes are packed in parallel on the thread pool. 
+ * Like the .fai, it goes to a temporary file that is renamed into place, and 
+ * nothing is written if a genome can't be packed, or its name is empty, too 
+ * long or not unique.  Each genome is named with the first word of its 
+ * description, as faToTwoBit does.  The .idx that goes with it keeps what 
+ * 'readPackIndex' needs to tell the cache is still good, and where each 
+ * genome is in the FASTA file so the stats from the cache match its own.
+ *
+ * @param path The path to the .2bit file.
+ * @param records The genomes in the FASTA file.
+ * @param mem The char array that contains the FASTA file.
+ * @param sb The stats of the FASTA file when it was opened.
+ */
+void writeTwoBit(const std::string& path, const std::vector<Record>& records,
+                 const char* mem, const struct stat& sb) {
+    std::vector<PackedRecord> packed(records.size());
+    TaskGroup group;
+    for (BigInt r = 0; r < records.size(); r++) {
+        pool->submit(group, [&records, &packed, r, mem] {
+            packRecord(records[r], mem, packed[r]);
+        });
+    }
+    pool->wait(group);
+
+    std::vector<std::string> names;
+    for (auto& p : packed) {
+        if (!p.ok) {
+            std::cout << "Not writing " << path 
+                      << ": only A, C, G, T and N can be packed\n";
+            return;
+        }
+        if (p.name.empty() || p.name.size() > 255) {
+            std::cout << "Not writing " << path 
+                      << ": a name is empty or too long\n";
+            return;
+        }
+        names.push_back(p.name);
+    }
+    std::sort(names.begin(), names.end());
+    if (std::adjacent_find(names.begin(), names.end()) != names.end()) {
+        std::cout << "Not writing " << path << ": the names aren't unique\n";
+        return;
+    }
+
+    // Work out where each record goes, with 64 bit offsets if they need it
+    BigInt indexSize = 0, dataSize = 0;
+    for (auto& p : packed) {
+        indexSize += 1 + p.name.size() + 4;
+        dataSize += 16 + 4 * (p.nBlocks.size() + p.maskBlocks.size()) + 
+                    p.dna.size();
+    }
+    uint32_t version = (16 + indexSize + dataSize > UINT32_MAX) ? 1 : 0;
+    BigInt offsetSize = (version == 1) ? 8 : 4;
+    BigInt offset = 16 + indexSize + (offsetSize - 4) * packed.size();
+
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    auto put32 = [&out](uint32_t value) {
+        out.write(reinterpret_cast<const char*>(&value), 4);
+    };
+    put32(TWOBIT_SIGNATURE);
+    put32(version);
+    put32(packed.size());
+    put32(0);
+    for (auto& p : packed) {
+        out.put(static_cast<char>(p.name.size()));
+        out << p.name;
+        if (version == 1) {
+            out.write(reinterpret_cast<const char*>(&offset), 8);
+        } else {
+            put32(offset);
+        }
+        offset += 16 + 4 * (p.nBlocks.size() + p.maskBlocks.size()) + 
+                  p.dna.size();
+    }
+    for (auto& p : packed) {
+        put32(p.dnaSize);
+        put32(p.nBlocks.size() / 2);
+        out.write(reinterpret_cast<const char*>(p.nBlocks.data()), 
+                  4 * p.nBlocks.size());
+        put32(p.maskBlocks.size() / 2);
+        out.write(reinterpret_cast<const char*>(p.maskBlocks.data()), 
+                  4 * p.maskBlocks.size());
+        put32(0);
+        out.write(reinterpret_cast<const char*>(p.dna.data()), p.dna.size());
+    }
+    out.close();
+    std::string idxPath = path + ".idx";
+    unlink(idxPath.c_str());
+    if (!out || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "Could not write " << path << "\n";
+        unlink(tmp.c_str());
+        return;
+    }
+
+    // Then the .idx, without which the cache isn't used
+    struct stat cb;
+    std::string idxTmp = idxPath + ".tmp";
+    std::ofstream idx(idxTmp);
+    if (stat(path.c_str(), &cb) == 0) {
+        idx << sb.st_size << '\t' << sb.st_mtim.tv_sec << '\t' 
+            << sb.st_mtim.tv_nsec << '\t' << cb.st_size << '\n';
+        for (auto& record : records) {
+            idx << record.start << '\t' << record.end << '\n';
+        }
+    } else {
+        idx.setstate(std::ios::failbit);
+    }
+    idx.close();
+    if (!idx || rename(idxTmp.c_str(), idxPath.c_str()) != 0) {
+        std::cout << "Could not write " << idxPath << "\n";
+        unlink(idxTmp.c_str());
+        return;
+    }
+    std::cout << "Wrote packed cache " << path << "\n";
+}  // End of the 'writeTwoBit' function
+
+/**
+ * This is the interface shared by the readers that hand out the input a 
+ * block at a time, when it can't be mmaped as is.  Blocks come out in order 
+ * and are only reused once they have been released, so a reader never holds 
+ * more than 'STREAM_BUFFERS' of them.
+ */
+class BlockReader {
+public:
+    /**
+     * This is a struct to hold one filled block of the input.
+     */
+    struct Block {
+        int buffer;      // Index of the buffer, to release it with
+        const char* mem; // The bytes that were read
+        BigInt len;      // Number of bytes that were read
+    };
+
+    static const int STREAM_BUFFERS = 3;
+
+    virtual ~BlockReader() {}
+
+    /**
+     * This is the function that will hand over the next block of the input,
+     * in order.  It blocks until the block is ready.
+     *
+     * @param block The block that was read.
+     * @returns False at the end of the input, or if reading failed.
+     */
+    virtual bool next(Block& block) = 0;
+
+    /**
+     * This is the function that will give a block back to be refilled.
+     *
+     * @param block The block to release.
+     */
+    virtual void release(const Block& block) = 0;
+
+    /**
+     * @returns True if the input couldn't be read or decompressed.
+     */
+    virtual bool failed() const = 0;
+};  // End of the 'BlockReader' class
+
+/**
+ * This is the reader for input that can't be mmaped, like stdin or a pipe.  A
+ * thread of its own fills a ring of 'STREAM_BUFFERS' blocks with 'read', so
+ * the next block is being read while the last ones are counted.  Input that 
+ * starts with the gzip magic is inflated on that thread, one member after 
+ * another, which covers plain gzip as well as BGZF that can't be mmaped.
+ */
+class StreamReader : public BlockReader {
+public:
+    /**
+     * This is the constructor.  It will start the reading thread.
+     *
+     * @param fd The file descriptor to read from.
+     * @param blockSize The number of bytes in each block.
+     */
+    StreamReader(int fd, BigInt blockSize) 
+        : fd(fd), blockSize(blockSize), raw(new char[RAW_SIZE]) {
+        for (int b = 0; b < STREAM_BUFFERS; b++) {
+            buffers.emplace_back(new char[blockSize]);
+            freeBuffers.push_back(b);
+        }
+        reader = std::thread(&StreamReader::readLoop, this);
+    }  // End of the constructor
+
+    /**
+     * This is the destructor.  It will stop the reading thread.
+     */
+    ~StreamReader() {
+        {  // Critical section
+        std::lock_guard<std::mutex> lock(ringLock);
+        stopping = true;
+        }
+        changed.notify_all();
+        reader.join();
+        if (gzip) {
+            inflateEnd(&strm);
+        }
+    }  // End of the destructor
+
+    bool next(Block& block) override {
+        std::unique_lock<std::mutex> lock(ringLock);
+        changed.wait(lock, [this] { return !filled.empty() || finished; });
+        if (filled.empty()) {
+            return false;
+        }
+        block = filled.front();
+        filled.pop_front();
+        return true;
+    }  // End of the 'next' function
+
+    void release(const Block& block) override {
+        {  // Critical section
+        std::lock_guard<std::mutex> lock(ringLock);
+        freeBuffers.push_back(block.buffer);
+        }
+        changed.notify_all();
+    }  // End of the 'release' function
+
+    bool failed() const override {
+        return error;
+    }  // End of the 'failed' function
+
+private:
+    static const BigInt RAW_SIZE = 1 << 20;  // Compressed bytes read at a time
+
+    /**
+     * This is a helper function that will read more of the input into 'raw' 
+     * once the last of it has been used up.
+     *
+     * @returns False at the end of the input.
+     */
+    bool readRaw() {
+        while (rawPos == rawLen && !rawEof) {
+            ssize_t got = read(fd, raw.get(), RAW_SIZE);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            rawPos = 0;
+            rawLen = (got > 0) ? got : 0;
+            rawEof = got <= 0;
+            error = error || got < 0;
+        }
+        return rawPos < rawLen;
+    }  // End of the 'readRaw' function
+
+    /**
+     * This is a helper function that will fill a buffer all the way, unless 
+     * the input ends first.  Plain input that 'raw' has run dry for is read 
+     * straight into the buffer.
+     *
+     * @param mem The buffer.
+     * @returns The number of bytes put in the buffer.
+     */
+    BigInt fill(char* mem) {
+        BigInt len = 0;
+        while (len < blockSize && !error && readRaw()) {
+            BigInt avail = rawLen - rawPos;
+            if (!gzip) {
+                BigInt n = std::min(avail, blockSize - len);
+                memcpy(mem + len, raw.get() + rawPos, n);
+                rawPos += n;
+                len += n;
+                while (rawPos == rawLen && !rawEof && len < blockSize) {
+                    ssize_t got = read(fd, mem + len, blockSize - len);
+                    if (got < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    rawEof = got <= 0;
+                    error = error || got < 0;
+                    len += (got > 0) ? got : 0;
+                }
+                continue;
+            }
+            strm.next_in = reinterpret_cast<Bytef*>(raw.get() + rawPos);
+            strm.avail_in = static_cast<uInt>(avail);
+            strm.next_out = reinterpret_cast<Bytef*>(mem + len);
+            strm.avail_out = static_cast<uInt>(
+                    std::min<BigInt>(blockSize - len, UINT32_MAX));
+            uInt room = strm.avail_out;
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            len += room - strm.avail_out;
+            rawPos = rawLen - strm.avail_in;
+            if (ret == Z_STREAM_END) {
+                // Another member may follow
+                inflateReset(&strm);
+                inMember = false;
+            } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+                inMember = true;
+            } else {
+                error = true;
+            }
+        }
+        // A member cut off by the end of the input is an error
+        if (gzip && inMember && rawEof && rawPos == rawLen) {
+            error = true;
+        }
+        return len;
+    }  // End of the 'fill' function
+
+    /**
+     * This is the function for the reading thread to execute.  It looks at 
+     * the first bytes for the gzip magic, then fills each free buffer.
+     */
+    void readLoop() {
+        while (rawLen < 2 && !rawEof) {
+            ssize_t got = read(fd, raw.get() + rawLen, RAW_SIZE - rawLen);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            rawEof = got <= 0;
+            error = error || got < 0;
+            rawLen += (got > 0) ? got : 0;
+        }
+        if (rawLen >= 2 && static_cast<unsigned char>(raw[0]) == 0x1f && 
+            static_cast<unsigned char>(raw[1]) == 0x8b) {
+            memset(&strm, 0, sizeof(strm));
+            gzip = inflateInit2(&strm, 15 + 16) == Z_OK;
+            error = error || !gzip;
+        }
+        while (true) {
+            int b;
+            {  // Critical section
+            std::unique_lock<std::mutex> lock(ringLock);
+            changed.wait(lock, [this] {
+                return stopping || !freeBuffers.empty();
+            });
+            if (stopping) {
+                return;
+            }
+            b = freeBuffers.front();
+            freeBuffers.pop_front();
+            }
+            char* mem = buffers[b].get();
+            BigInt len = fill(mem);
+            bool eof = len < blockSize;
+            {  // Critical section
+            std::lock_guard<std::mutex> lock(ringLock);
+            if (len > 0) {
+                filled.push_back(Block{b, mem, len});
+            } else {
+                freeBuffers.push_back(b);
+            }
+            finished = eof;
+            }
+            changed.notify_all();
+            if (eof) {
+                return;
+            }
+        }
+    }  // End of the 'readLoop' function
+
+    int fd;
+    BigInt blockSize;
+    std::vector<std::unique_ptr<char[]>> buffers;
+    std::deque<int> freeBuffers;    // Buffers waiting to be filled
+    std::deque<Block> filled;       // Blocks waiting to be counted
+    bool finished = false;          // The last block has been read
+    bool stopping = false;
+    std::atomic<bool> error{false};
+    std::mutex ringLock;
+    std::condition_variable changed;  // Signaled when either queue changes
+    std::thread reader;
+    // Only touched by the reading thread
+    std::unique_ptr<char[]> raw;    // Input not used up yet
+    BigInt rawPos = 0;
+    BigInt rawLen = 0;
+    bool rawEof = false;
+    bool gzip = false;              // The input is being inflated
+    bool inMember = false;          // Part way through a gzip member
+    z_stream strm;
+};  // End of the 'StreamReader' class
+
+/**
+ * This is a struct to hold where the parts of one BGZF member are.
+ */
+struct BgzfMember {
+    BigInt data;     // Index of the deflated bytes
+    BigInt dataLen;  // Number of deflated bytes
+    BigInt bsize;    // Size of the whole member
+    BigInt outLen;   // Number of bytes it inflates to
+    uint32_t crc;    // CRC32 of the inflated bytes
+};  // End of the 'BgzfMember' struct
+
+// The most a BGZF member can inflate to
+const BigInt BGZF_MAX_BLOCK = 1 << 16;
+
+/**
+ * This is a helper function that will read the header and trailer of the 
+ * BGZF member that starts at an index of the file.  Its size comes from the 
+ * 'BC' subfield of the gzip extra field.
+ *
+ * @param mem The mmaped BGZF file.
+ * @param size The size of the file.
+ * @param at The index of the member.
+ * @param member The member to fill in.
+ * @returns False if it isn't a BGZF member that fits in the file.
+ */
+bool readMember(const unsigned char* mem, BigInt size, BigInt at, 
+                BgzfMember& member) {
+    if (size - at < 18 || mem[at] != 0x1f || mem[at + 1] != 0x8b || 
+        mem[at + 2] != 8 || (mem[at + 3] & 4) == 0) {
+        return false;
+    }
+    BigInt xlen = mem[at + 10] | (mem[at + 11] << 8);
+    if (size - at < 12 + xlen) {
+        return false;
+    }
+    // Look through the extra subfields for 'BC'
+    BigInt bsize = 0;
+    for (BigInt f = at + 12; f + 4 <= at + 12 + xlen; ) {
+        BigInt slen = mem[f + 2] | (mem[f + 3] << 8);
+        if (mem[f] == 'B' && mem[f + 1] == 'C' && slen == 2) {
+            bsize = (mem[f + 4] | (mem[f + 5] << 8)) + 1;
+        }
+        f += 4 + slen;
+    }
+    if (bsize < 12 + xlen + 8 || bsize > size - at) {
+        return false;
+    }
+    auto load32 = [mem](BigInt i) {
+        return mem[i] | (mem[i + 1] << 8) | (mem[i + 2] << 16) | 
+               (static_cast<uint32_t>(mem[i + 3]) << 24);
+    };
+    member.data = at + 12 + xlen;
+    member.dataLen = bsize - 12 - xlen - 8;
+    member.bsize = bsize;
+    member.crc = load32(at + bsize - 8);
+    member.outLen = load32(at + bsize - 4);
+    return member.outLen <= BGZF_MAX_BLOCK;
+}  // End of the 'readMember' function
+
+/**
+ * This is the function that inflates one BGZF member and checks its CRC.
+ *
+ * @param mem The mmaped BGZF file.
+ * @param member The member.
+ * @param out Where to put the 'outLen' inflated bytes.
+ * @returns False if the member is corrupt.
+ */
+bool inflateMember(const unsigned char* mem, const BgzfMember& member, 
+                   char* out) {
+    if (member.outLen == 0) {
+        return true;
+    }
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -15) != Z_OK) {
+        return false;
+    }
+    strm.next_in = const_cast<Bytef*>(mem + member.data);
+    strm.avail_in = static_cast<uInt>(member.dataLen);
+    strm.next_out = reinterpret_cast<Bytef*>(out);
+    strm.avail_out = static_cast<uInt>(member.outLen);
+    int ret = inflate(&strm, Z_FINISH);
+    bool ok = ret == Z_STREAM_END && strm.avail_out == 0;
+    inflateEnd(&strm);
+    return ok && crc32(0, reinterpret_cast<Bytef*>(out), member.outLen) == 
+                 member.crc;
+}  // End of the 'inflateMember' function
+
+/**
+ * This is a struct to hold a samtools compatible .gzi index of a BGZF file: 
+ * where each member starts, in the file and in the inflated data.  The first 
+ * member is left out of the file, but is kept here as the first entry.
+ */
+struct GziIndex {
+    BigIVec compressed;    // Index of each member in the file
+    BigIVec uncompressed;  // Index of each member in the inflated data
+};  // End of the 'GziIndex' struct
+
+/**
+ * This is the reader for BGZF files, which are a series of gzip members of at 
+ * most 64 KiB each that say how big they are in their header.  The file is 
+ * mmaped and each block handed out is filled by inflating its members in 
+ * parallel on the thread pool.  The members of the next block are inflated 
+ * while the last ones are still being counted.  The .gzi is built on the way.
+ */
+class BgzfReader : public BlockReader {
+public:
+    /**
+     * This is the constructor.
+     *
+     * @param mem The mmaped BGZF file.
+     * @param size The size of the file.
+     * @param blockSize The number of inflated bytes in each block.
+     */
+    BgzfReader(const char* mem, BigInt size, BigInt blockSize) 
+        : mem(reinterpret_cast<const unsigned char*>(mem)), size(size),
+          blockSize(std::max<BigInt>(blockSize, BGZF_MAX_BLOCK)) {
+        for (int b = 0; b < STREAM_BUFFERS; b++) {
+            buffers.emplace_back(new char[this->blockSize]);
+            freeBuffers.push_back(b);
+        }
+    }  // End of the constructor
+
+    bool next(Block& block) override {
+        if (error || pos == size || freeBuffers.empty()) {
+            return false;
+        }
+        block.buffer = freeBuffers.front();
+        block.mem = buffers[block.buffer].get();
+        block.len = 0;
+
+        // Take as many members as fit in the block
+        std::vector<std::pair<BgzfMember, BigInt>> members;
+        while (pos < size) {
+            BgzfMember m;
+            if (!readMember(mem, size, pos, m)) {
+                error = true;
+                return false;
+            }
+            if (block.len + m.outLen > blockSize) {
+                break;
+            }
+            gzi.compressed.push_back(pos);
+            gzi.uncompressed.push_back(inflated + block.len);
+            members.emplace_back(m, block.len);
+            block.len += m.outLen;
+            pos += m.bsize;
+        }
+        freeBuffers.pop_front();
+        inflated += block.len;
+
+        // Inflate them on the thread pool
+        char* out = buffers[block.buffer].get();
+        TaskGroup group;
+        for (auto& m : members) {
+            pool->submit(group, [this, m, out] {
+                if (!inflateMember(mem, m.first, out + m.second)) {
+                    error = true;
+                }
+            });
+        }
+        pool->wait(group);
+        if (block.len == 0) {
+            // Only empty members were left, like the BGZF end of file marker
+            freeBuffers.push_front(block.buffer);
+            return false;
+        }
+        return !error;
+    }  // End of the 'next' function
+
+    void release(const Block& block) override {
+        freeBuffers.push_back(block.buffer);
+    }  // End of the 'release' function
+
+    bool failed() const override {
+        return error;
+    }  // End of the 'failed' function
+
+    /**
+     * @returns The .gzi of the members read so far.
+     */
+    const GziIndex& index() const {
+        return gzi;
+    }  // End of the 'index' function
+
+    /**
+     * This is the function that will check if a file starts with a BGZF 
+     * header, which is a gzip header with a 'BC' extra field.
+     *
+     * @param head The first bytes of the file.
+     * @param len The number of bytes in 'head'.
+     * @returns True if it is a BGZF file.
+     */
+    static bool isBgzf(const unsigned char* head, BigInt len) {
+        return len >= 18 && head[0] == 0x1f && head[1] == 0x8b && 
+               head[2] == 8 && (head[3] & 4) != 0 && 
+               head[12] == 'B' && head[13] == 'C';
+    }  // End of the 'isBgzf' function
+
+private:
+    const unsigned char* mem;
+    BigInt size;
+    BigInt blockSize;
+    BigInt pos = 0;                 // Index of the next member
+    BigInt inflated = 0;            // Bytes inflated so far
+    GziIndex gzi;
+    std::vector<std::unique_ptr<char[]>> buffers;
+    std::deque<int> freeBuffers;    // Only touched by the counting thread
+    std::atomic<bool> error{false};
+};  // End of the 'BgzfReader' class
+
+/**
+ * This is the function that will write a .gzi, which is the number of 
+ * entries and then each entry's compressed and uncompressed index, as 
+ * little endian 64 bit words.  Like the .fai, it is renamed into place.
+ *
+ * @param path The path to the .gzi file.
+ * @param gzi The index to write.
+ */
+void writeGzi(const std::string& path, const GziIndex& gzi) {
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    uint64_t count = gzi.compressed.empty() ? 0 : gzi.compressed.size() - 1;
+    out.write(reinterpret_cast<const char*>(&count), 8);
+    for (BigInt i = 1; i < gzi.compressed.size(); i++) {
+        uint64_t pair[2] = {gzi.compressed[i], gzi.uncompressed[i]};
+        out.write(reinterpret_cast<const char*>(pair), 16);
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "Could not write " << path << "\n";
+        unlink(tmp.c_str());
+        return;
+    }
+    std::cout << "Wrote index " << path << "\n";
+}  // End of the 'writeGzi' function
+
+/**
+ * This is the function that will read a .gzi, if it is newer than the BGZF 
+ * file.  The entries must be in order and inside the file.
+ *
+ * @param path The path to the .gzi file.
+ * @param sb The stats of the BGZF file.
+ * @param gzi The index to fill in.
+ * @returns False if the .gzi is missing, stale or malformed.
+ */
+bool readGzi(const std::string& path, const struct stat& sb, GziIndex& gzi) {
+    struct stat ib;
+    if (stat(path.c_str(), &ib) != 0 || ib.st_mtime < sb.st_mtime) {
+        return false;
+    }
+    std::ifstream in(path, std::ios::binary);
+    uint64_t count;
+    if (!in.read(reinterpret_cast<char*>(&count), 8) || 
+        count > static_cast<BigInt>(ib.st_size) / 16) {
+        return false;
+    }
+    gzi.compressed.assign(1, 0);
+    gzi.uncompressed.assign(1, 0);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t pair[2];
+        if (!in.read(reinterpret_cast<char*>(pair), 16) || 
+            pair[0] <= gzi.compressed.back() || 
+            pair[1] < gzi.uncompressed.back() || 
+            pair[0] >= static_cast<BigInt>(sb.st_size)) {
+            return false;
+        }
+        gzi.compressed.push_back(pair[0]);
+        gzi.uncompressed.push_back(pair[1]);
+    }
+    return true;
+}  // End of the 'readGzi' function
+
+/**
+ * This is the function that will inflate just the members of a BGZF file 
+ * that cover a range of the inflated data, found with the .gzi.
+ *
+ * @param mem The mmaped BGZF file.
+ * @param size The size of the file.
+ * @param gzi The index of the file.
+ * @param start The first inflated byte wanted.
+ * @param end One past the last inflated byte wanted.
+ * @param out The string to put the bytes in.  It comes up short of 'end' if 
+ *            the file does.
+ * @returns False if a member is corrupt.
+ */
+bool inflateRange(const unsigned char* mem, BigInt size, const GziIndex& gzi,
+                  BigInt start, BigInt end, std::string& out) {
+    out.clear();
+    // The last member that starts at or before 'start'
+    BigInt m = std::upper_bound(gzi.uncompressed.begin(), 
+                                gzi.uncompressed.end(), start) - 
+               gzi.uncompressed.begin() - 1;
+    BigInt at = gzi.compressed[m];
+    BigInt from = gzi.uncompressed[m];
+    char block[BGZF_MAX_BLOCK];
+    while (from < end) {
+        BgzfMember member;
+        if (at >= size) {
+            break;
+        }
+        if (!readMember(mem, size, at, member) || 
+            !inflateMember(mem, member, block)) {
+            return false;
+        }
+        BigInt lo = std::max(start, from), hi = std::min(end, from + member.outLen);
+        if (lo < hi) {
+            out.append(block + (lo - from), hi - lo);
+        }
+        from += member.outLen;
+        at += member.bsize;
+    }
+    return true;
+}  // End of the 'inflateRange' function
 
 /**
- * This is a struct to help manage getting descriptions of genomes from the 
- * file.
+ * This is the reader for --mem-limit, which keeps a big file from taking over 
+ * the page cache.  Rather than mmap the whole file, it maps one window at a 
+ * time, and each block it hands out points straight into a window.  Once a 
+ * window is released it is unmapped and its pages are dropped from the page 
+ * cache, so at most 'STREAM_BUFFERS' windows of the file are ever resident.
  */
-struct Description {
-    std::string desc;  // To hold the description of the genome
-    BigInt ending;     // To hold the index that the description ended at
-};  // End of the 'Description' struct
+class WindowReader : public BlockReader {
+public:
+    /**
+     * This is the constructor.
+     *
+     * @param fd The file descriptor of the file.
+     * @param size The size of the file.
+     * @param windowSize The number of bytes in each window, a multiple of 
+     *                   the page size.
+     */
+    WindowReader(int fd, BigInt size, BigInt windowSize) 
+        : fd(fd), size(size), windowSize(windowSize), 
+          windows(STREAM_BUFFERS) {}
+
+    /**
+     * This is the destructor.  It will unmap any window still mapped.
+     */
+    ~WindowReader() {
+        for (auto& w : windows) {
+            if (w.mem != NULL) {
+                release(w);
+            }
+        }
+    }  // End of the destructor
+
+    bool next(Block& block) override {
+        if (pos == size) {
+            return false;
+        }
+        int b = 0;
+        while (windows[b].mem != NULL) {
+            b++;
+        }
+        BigInt len = std::min(windowSize, size - pos);
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        if (adviceName == "populate") {
+            flags |= MAP_POPULATE;
+        }
+#endif
+        void* mem = mmap(NULL, len, PROT_READ, flags, fd, pos);
+        if (mem == MAP_FAILED) {
+            error = true;
+            return false;
+        }
+        // Start reading the window in while the last ones are counted
+        madvise(mem, len, adviceName == "normal" ? MADV_SEQUENTIAL : 
+                          MADV_WILLNEED);
+        windows[b] = Block{b, static_cast<const char*>(mem), len};
+        offsets[b] = pos;
+        pos += len;
+        block = windows[b];
+        return true;
+    }  // End of the 'next' function
+
+    void release(const Block& block) override {
+        Block& w = windows[block.buffer];
+        munmap(const_cast<char*>(w.mem), w.len);
+        posix_fadvise(fd, offsets[block.buffer], w.len, POSIX_FADV_DONTNEED);
+        w.mem = NULL;
+    }  // End of the 'release' function
+
+    bool failed() const override {
+        return error;
+    }  // End of the 'failed' function
+
+private:
+    int fd;
+    BigInt size;
+    BigInt windowSize;
+    BigInt pos = 0;                    // Index of the next window
+    std::vector<Block> windows;        // The mapped windows, by buffer
+    BigInt offsets[STREAM_BUFFERS];    // Index each window was mapped at
+    bool error = false;
+};  // End of the 'WindowReader' class
 
 /**
- * This is a helper function that will prompt out the usage to the user.
+ * This is the reader for --io=direct, which skips the page cache.  The file 
+ * is opened with O_DIRECT and each block of the ring is filled by many 
+ * aligned 'pread' calls run on the thread pool at once, so the drive sees a 
+ * deep queue instead of one page fault at a time.  Blocks are read ahead of 
+ * the counting: a block starts being refilled as soon as it is released.
  */
-void usage() {
-    std::cerr << "Usage: ./<EXECUTABLE> <PATH_TO_FASTA_FILE> <NUM_THREADS>\n";
-}  // End of the 'usage' function
+class DirectReader : public BlockReader {
+public:
+    /**
+     * This is the constructor.  It will start reading the first blocks.
+     *
+     * @param fd The file descriptor, opened with O_DIRECT if it could be.
+     * @param size The size of the file.
+     * @param blockSize The number of bytes in each block, a multiple of 
+     *                  'DIRECT_ALIGN'.
+     */
+    DirectReader(int fd, BigInt size, BigInt blockSize) 
+        : fd(fd), size(size), blockSize(blockSize), slots(STREAM_BUFFERS) {
+        for (int b = 0; b < STREAM_BUFFERS; b++) {
+            void* mem = NULL;
+            if (posix_memalign(&mem, DIRECT_ALIGN, blockSize) != 0) {
+                throw std::bad_alloc();
+            }
+            slots[b].mem.reset(static_cast<char*>(mem));
+            startRead(b);
+        }
+    }  // End of the constructor
+
+    /**
+     * This is the destructor.  It will wait for the reads still going.
+     */
+    ~DirectReader() {
+        for (auto& slot : slots) {
+            pool->wait(slot.group);
+        }
+    }  // End of the destructor
+
+    bool next(Block& block) override {
+        Slot& slot = slots[nextSlot];
+        pool->wait(slot.group);
+        if (error || slot.len == 0) {
+            return false;
+        }
+        block = Block{nextSlot, slot.mem.get(), slot.len};
+        nextSlot = (nextSlot + 1) % STREAM_BUFFERS;
+        return true;
+    }  // End of the 'next' function
+
+    void release(const Block& block) override {
+        startRead(block.buffer);
+    }  // End of the 'release' function
+
+    bool failed() const override {
+        return error;
+    }  // End of the 'failed' function
+
+    static const BigInt DIRECT_ALIGN = 4096;    // O_DIRECT alignment
+    static const BigInt DIRECT_CHUNK = 1 << 20;  // Bytes in one pread
+
+private:
+    struct Deleter {
+        void operator()(char* mem) const { free(mem); }
+    };
+
+    struct Slot {
+        std::unique_ptr<char, Deleter> mem;
+        BigInt len = 0;
+        TaskGroup group;  // The reads filling the slot
+    };
+
+    /**
+     * This is a helper function that will queue the reads for the next 
+     * block of the file into a slot.  Blocks are handed out round robin, so 
+     * the slots fill in file order.
+     *
+     * @param b The index of the slot.
+     */
+    void startRead(int b) {
+        Slot& slot = slots[b];
+        slot.len = std::min(blockSize, size - pos);
+        char* mem = slot.mem.get();
+        for (BigInt off = 0; off < slot.len; off += DIRECT_CHUNK) {
+            // Lengths are rounded up, a read past the end just comes up short
+            BigInt want = std::min(DIRECT_CHUNK, slot.len - off);
+            BigInt len = (want + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+            BigInt at = pos + off;
+            pool->submit(slot.group, [this, mem, off, at, len, want] {
+                BigInt got = 0;
+                while (got < want) {
+                    ssize_t n = pread(fd, mem + off + got, len - got, at + got);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        error = true;
+                        return;
+                    }
+                    got += n;
+                }
+            });
+        }
+        pos += slot.len;
+    }  // End of the 'startRead' function
+
+    int fd;
+    BigInt size;
+    BigInt blockSize;
+    BigInt pos = 0;                 // Index of the next block to read
+    int nextSlot = 0;               // Slot to hand out next
+    std::vector<Slot> slots;
+    std::atomic<bool> error{false};
+};  // End of the 'DirectReader' class
+
+/**
+ * This is a struct to hold a genome read from a stream.  The stream's blocks
+ * are reused, so the description is copied out of them.  'pending' starts at
+ * one for the stream itself, which lets go once the genome's last byte has
+ * been read.  Whoever lets go last hands the stats to the writer.
+ */
+struct StreamRecord {
+    std::string desc;              // The description of the genome
+    BigInt seq;                    // Sequence number for the ordered writer
+    BigInt file;                   // Index of the file in the list of inputs
+    BigInt start;                  // Index of the genome's '>' in the stream
+    std::mutex lock;               // Guards 'counts'
+    Counts counts;                 // The pieces counted so far
+    std::atomic<BigInt> pending{1};  // Pieces still being counted, and the stream
+    unsigned char lastBase = BASE_SKIP;  // Code of the last base read so far
+};  // End of the 'StreamRecord' struct
 
 /**
- * This is the function that will print out the stats collected from the file.
+ * This is a helper function that will let go of a streamed genome, and write
+ * its stats if that was the last thing it was waiting on.
  *
- * @param desc The description of the genome from the file.
- * @param G The count of G nucleotides in the genome.
- * @param C The count of C nucleotides in the genome.
- * @param T The count of T nucleotides in the genome.
- * @param A The count of A nucleotides in the genome.
- * @param N The count of N necleotides in the genome.
- * @param total The total count of nucleotides in the genome.
- */
-void printStats(const std::string& desc, size_t G, size_t C, size_t A, 
-                                        size_t T, size_t N, size_t total) {
-//    {  // Critical section
-//    std::lock_guard<std::mutex> lock(mute);
-//    ofile << '\n' << desc << '\n' << '\n';
-//    ofile << "G: " << G << '\n';
-//    ofile << "C: " << C << '\n';
-//    ofile << "A: " << A << '\n';
-//    ofile << "T: " << T << '\n';
-//    ofile << "N: " << N << '\n';
-//    ofile << std::setw(35) << std::setfill('-');
-//    ofile << "\nTotal: " << total << '\n';
-//    }  // End of the critical section
-
-    std::stringstream table;
-    table << "\n" << desc << "\n\n";
-    table << "G: " << G << "\n";
-    table << "C: " << C << "\n";
-    table << "A: " << A << "\n";
-    table << "T: " << T << "\n";
-    table << "N: " << N << "\n";
-    table << "-----------------------------------";
-    table << "\nTotal: " << total << "\n";
-    {  // Critical section
-    std::lock_guard<std::mutex> lock(mute);
-    ofile << table.str();
+ * @param record The genome.
+ */
+void releaseStreamRecord(StreamRecord& record) {
+    if (--record.pending == 0) {
+        writeStats(record.seq, record.desc, record.file, record.start, 
+                   record.counts);
     }
-}  // End of the 'printStats' function
+}  // End of the 'releaseStreamRecord' function
 
 /**
- * This is the function that will get the description of a genome from the file
- * that is opened.
+ * This is a helper function that will count the dinucleotide split by the 
+ * end of a block, since the pieces of a block can't look into the next one. 
+ * Then it remembers the last base of the genome's part in this block.
  *
- * @param mem The file that is mmaped.
- * @param start The index of where the description starts.
- * @param size The size of the file.
- * @returns The description struct that contains the name from the file.  And
- *          the index that the description ends at.
+ * @param record The genome.
+ * @param mem The block.
+ * @param start The first byte of the genome in the block.
+ * @param end One past its last byte in the block.
  */
-Description getDescription(const char* mem, BigInt start, BigInt size) {
-    Description des;
-    std::string name = "";
-    for (BigInt i = start; i < size; i++) {
-        if (mem[i] == '\n') {
-            des.ending = i;
-            break;
-        }
-        name += mem[i];
+void linkStreamPairs(StreamRecord& record, const char* mem, BigInt start, 
+                     BigInt end) {
+    const unsigned char* code = BASE_CODES.code;
+    BigInt i = start;
+    while (i < end && code[static_cast<unsigned char>(mem[i])] == BASE_SKIP) {
+        i++;
     }
-    des.desc = name;
-    return des;
-}  // End of the 'getDescription' function
+    if (i == end) {
+        return;
+    }
+    unsigned char first = code[static_cast<unsigned char>(mem[i])];
+    if (record.lastBase < 4 && first < 4) {
+        std::lock_guard<std::mutex> lock(record.lock);
+        record.counts.pairs[record.lastBase * 4 + first]++;
+    }
+    BigInt j = end;
+    while (code[static_cast<unsigned char>(mem[j - 1])] == BASE_SKIP) {
+        j--;
+    }
+    record.lastBase = code[static_cast<unsigned char>(mem[j - 1])];
+}  // End of the 'linkStreamPairs' function
 
 /**
- * This is the function that will read each nucleotide from the file and 
- * collect thier counts.  Then it will invoke the function that prints out the 
- * counts.  It will be run as a task so that it can be parallelized.
+ * This is a helper function that will queue the tasks counting part of a
+ * streamed genome that sits in one block.
  *
- * @param desc The description of the genome from the file. 
- * @param start The starting index after the description of the genome.
- * @param end The ending index of the individual genome.
- * @param mem The char array of the file.
+ * @param record The genome.
+ * @param mem The block.
+ * @param start The first byte to count.
+ * @param end One past the last byte to count.
+ * @param group The group of the block's tasks.
  */
-void collectCounts(std::string desc, BigInt start, BigInt end, const char* mem) {
-    // Declare size_ts to hold counts
-    size_t G = 0; size_t C = 0; size_t A = 0; 
-    size_t T = 0; size_t N = 0; size_t total = 0;
-    
-    // Loop through nucleotides in the file
-    char nucleotide;
-    for (BigInt i = start; i < end; i++) {
-        nucleotide = mem[i];
-        switch(nucleotide) {
-            case 'G':
-                G ++;
-                total++;
-                break;
-            case 'C':
-                C ++;
-                total++;
-                break;
-            case 'A':
-                A ++;
-                total++;
-                break;
-            case 'T':
-                T ++;
-                total++;
-                break;
-            case 'N':
-                N ++;
-                total++;
+void stageStreamPieces(std::shared_ptr<StreamRecord> record, const char* mem,
+                       BigInt start, BigInt end, TaskGroup& group) {
+    for (; start < end; start += pieceSize) {
+        BigInt stop = std::min(end, start + pieceSize);
+        record->pending++;
+        pool->submit(group, [record, mem, start, stop, end] {
+            Counts counts;
+            collectCounts(record->desc, start, stop, end, mem, counts);
+            {  // Critical section
+            std::lock_guard<std::mutex> lock(record->lock);
+            record->counts += counts;
+            }
+            releaseStreamRecord(*record);
+        });
+    }
+}  // End of the 'stageStreamPieces' function
+
+/**
+ * This is a class to build the .fai line of a streamed genome from its 
+ * lines as they go by, following the same rules as 'indexRecord': every 
+ * line is as wide as the first but the last, which is no wider, and blank 
+ * lines may only come at the end.
+ */
+class FaiBuilder {
+public:
+    /**
+     * This is the function that will start a genome.
+     *
+     * @param desc The description of the genome.
+     * @param offset Index of the genome's first base in the stream.
+     */
+    void begin(std::string_view desc, BigInt offset) {
+        entry = FaiEntry();
+        entry.name = std::string(recordName(desc));
+        entry.offset = offset;
+        ok = !entry.name.empty();
+        lineStart = contentEnd = offset;
+        prevCR = blankSeen = false;
+        lines = 0;
+    }  // End of the 'begin' function
+
+    /**
+     * This is the function that will take the next bytes of the stream.  Any 
+     * before the genome's first base are skipped.
+     *
+     * @param mem The bytes.
+     * @param len The number of bytes.
+     * @param at Index of the first byte in the stream.
+     */
+    void feed(const char* mem, BigInt len, BigInt at) {
+        if (at < entry.offset) {
+            BigInt skip = std::min(len, entry.offset - at);
+            mem += skip;
+            len -= skip;
+            at += skip;
+        }
+        BigInt i = 0;
+        while (i < len) {
+            const void* nl = memchr(mem + i, '\n', len - i);
+            BigInt stop = (nl == NULL) ? len : 
+                          static_cast<const char*>(nl) - mem;
+            BigInt j = stop;
+            while (j > i && mem[j - 1] == '\r') j--;
+            if (j > i) {
+                contentEnd = at + j;
+            }
+            bool cr = (stop > i) ? mem[stop - 1] == '\r' : prevCR;
+            if (nl == NULL) {
+                prevCR = cr;
                 break;
-        }  // End of the switch/case block
-    }  // End of the loop block
-    printStats(desc, G, C, A, T, N, total);
-}  // End of the 'collectCounts' function
+            }
+            endLine(at + stop + 1, cr);
+            prevCR = false;
+            i = stop + 1;
+        }
+    }  // End of the 'feed' function
+
+    /**
+     * This is the function that will finish the genome.
+     *
+     * @param end Index the genome ended at in the stream.
+     * @returns The .fai line, with an empty name if the genome can't be 
+     *          indexed.
+     */
+    FaiEntry finish(BigInt end) {
+        if (lineStart < end) {
+            endLine(end, false);
+        }
+        if (lines == 0) {
+            entry.length = entry.lineBases = entry.lineWidth = 0;
+        } else if (lines == 1) {
+            entry.length = entry.lineBases = lastContent;
+            entry.lineWidth = lastContent + 1;
+        } else {
+            entry.lineWidth = width;
+            entry.lineBases = width - (crlf ? 2 : 1);
+            if (lastContent > entry.lineBases) {
+                ok = false;
+            }
+            entry.length = (lines - 1) * entry.lineBases + lastContent;
+        }
+        if (!ok) {
+            entry.name.clear();
+        }
+        return entry;
+    }  // End of the 'finish' function
+
+private:
+    /**
+     * This is a helper function that will check a line once its end is 
+     * found.  A line is held until the next one comes, since only then is 
+     * it known to be a full line.
+     *
+     * @param next Index of the byte after the line.
+     * @param cr Whether the line ended with '\r\n'.
+     */
+    void endLine(BigInt next, bool cr) {
+        BigInt content = contentEnd - lineStart;
+        if (content == 0) {
+            blankSeen = true;
+        } else {
+            if (blankSeen) {
+                ok = false;
+            }
+            if (lines == 0) {
+                width = next - lineStart;
+                crlf = cr;
+            } else if (lastWidth != width || (crlf && !lastCR)) {
+                ok = false;
+            }
+            lastWidth = next - lineStart;
+            lastCR = cr;
+            lastContent = content;
+            lines++;
+        }
+        lineStart = contentEnd = next;
+    }  // End of the 'endLine' function
+
+    FaiEntry entry;
+    bool ok;                 // The genome can still be indexed
+    BigInt lineStart;        // Index of the line being read
+    BigInt contentEnd;       // One past its last byte that isn't a '\r'
+    bool prevCR;             // The bytes so far end with a '\r'
+    bool blankSeen;          // A blank line has been read
+    BigInt lines;            // Lines with bases, the held one included
+    BigInt width;            // Bytes in the first line
+    bool crlf;               // The first line ended with '\r\n'
+    BigInt lastWidth;        // Bytes in the held line
+    bool lastCR;             // The held line ended with '\r\n'
+    BigInt lastContent;      // Bases in the held line
+};  // End of the 'FaiBuilder' class
 
 /**
- * This is a helper function that will manage threads for counting nucleotides 
- * in each genome.
+ * This is the function that will count the genomes in a stream.  Each block
+ * is split at the headers in it, and its pieces are handed to the thread pool
+ * while the reader fills the next one.  A header or genome that runs past the
+ * end of a block is carried on into the next.  Like the mmaped path, anything
+ * before the first header is skipped.  Only the genomes asked for with 
+ * --records are counted, but every genome is indexed.
  *
- * @param indicies The vector containing each index each genome falls in.
- * @param mem The char array that contains the FASTA file.
- * @param size The size of the the char array.
+ * @param reader The reader to take the blocks from.
+ * @param file The index of the file in the list of inputs.
+ * @param index The .fai lines to build, or NULL to skip them.  A genome that 
+ *              can't be indexed is left with an empty name.
  */
-void stageCollections(BigIVec& indicies, const char* mem, BigInt size) {
-    std::cout << "Counting nucleotides...\n";
-    ThrdVec threads;
-    int threadsUsed;
-    for (BigInt i = 0; i < (indicies.size() - 1); (i += threadsUsed)) {
-        threadsUsed = 0;
-        for (int t = 0; t < numThreads; t++) {
-            // Calculate  the index
-            BigInt index = i + t;
-            // Prevent overflow past indicies vector's size
-            if (index < (indicies.size() - 1)) {
-                // Get the desciption
-                Description des = getDescription(mem, indicies[index], size);
-                // Collect counts of the nucleotides
-                threads.push_back(std::thread(collectCounts, des.desc, 
-                            des.ending, indicies[index + 1], mem));
-                threadsUsed++;
-            }
-        }
-        for (auto &th : threads) {
-            th.join();
-        }
-        threads.clear();
+void streamFile(BlockReader& reader, BigInt file, 
+                std::vector<FaiEntry>* index) {
+    std::cout << "Counting nucleotides from a stream...\n";
+    // The blocks being counted, oldest first, with their tasks
+    std::deque<std::pair<BlockReader::Block, std::unique_ptr<TaskGroup>>>
+            counting;
+    std::shared_ptr<StreamRecord> record;  // The genome being counted
+    bool inRecord = false;    // A genome has started, counted or not
+    bool inHeader = false;    // The record's header isn't finished yet
+    FaiBuilder builder;
+    // Once a header is read, the genome is indexed, and counted if it was 
+    // asked for
+    auto endHeader = [&](BigInt offset) {
+        if (index != NULL) {
+            builder.begin(record->desc, offset);
+        }
+        if (wantRecord(record->desc)) {
+            record->seq = writer->reserve();
+        } else {
+            record.reset();
+        }
+    };
+    bool lineStart = true;    // The next block starts a line
+    BigIVec found;
+    BlockReader::Block block;
+    BigInt base = 0;          // Index of the block in the stream
+    while (true) {
+        // Keep one buffer free for the reader
+        if (counting.size() == BlockReader::STREAM_BUFFERS - 1) {
+            pool->wait(*counting.front().second);
+            reader.release(counting.front().first);
+            counting.pop_front();
+        }
+        if (!reader.next(block)) {
+            break;
+        }
+        counting.emplace_back(block, std::unique_ptr<TaskGroup>(new TaskGroup));
+        TaskGroup& group = *counting.back().second;
+
+        // Find the headers, dropping a '>' at the start of the block when
+        // the last block didn't end a line
+        found.clear();
+        scanKernel(block.mem, 0, block.len, found);
+        BigInt h = (!found.empty() && found[0] == 0 && !lineStart) ? 1 : 0;
+
+        BigInt pos = 0;
+        while (pos < block.len) {
+            if (inHeader) {
+                const void* nl = memchr(block.mem + pos, '\n', block.len - pos);
+                BigInt ending = (nl == NULL) ? block.len :
+                                static_cast<const char*>(nl) - block.mem;
+                record->desc.append(block.mem + pos, ending - pos);
+                inHeader = (nl == NULL);
+                pos = ending;
+                if (!inHeader) {
+                    endHeader(base + ending + 1);
+                }
+                continue;
+            }
+            while (h < found.size() && found[h] < pos) h++;
+            BigInt end = (h < found.size()) ? found[h] : block.len;
+            if (record) {
+                stageStreamPieces(record, block.mem, pos, end, group);
+                if (countPairs) {
+                    linkStreamPairs(*record, block.mem, pos, end);
+                }
+            }
+            if (index != NULL && inRecord) {
+                builder.feed(block.mem + pos, end - pos, base + pos);
+            }
+            pos = end;
+            if (pos < block.len) {
+                // A new genome starts here
+                if (index != NULL && inRecord) {
+                    index->push_back(builder.finish(base + pos));
+                }
+                if (record) {
+                    releaseStreamRecord(*record);
+                }
+                inRecord = true;
+                record = std::make_shared<StreamRecord>();
+                record->file = file;
+                record->start = base + pos;
+                inHeader = true;
+            }
+        }
+        lineStart = (block.mem[block.len - 1] == '\n');
+        base += block.len;
+    }
+    if (inHeader) {
+        endHeader(base);
+    }
+    if (index != NULL && inRecord) {
+        index->push_back(builder.finish(base));
+    }
+    if (record) {
+        releaseStreamRecord(*record);
+    }
+    for (auto& c : counting) {
+        pool->wait(*c.second);
+        reader.release(c.first);
+    }
+    if (reader.failed()) {
+        std::cerr << "Could not read or decompress the input" << std::endl;
+        exit(-1);
     }
     std::cout << "Done counting nucleotides...\n";
-}  // End of the 'stageCollections' function
+}  // End of the 'streamFile' function
 
 /**
- * This is a helper function for the for each thread to execute.  It will 
- * check for indecies where a new genome starts.  Then it will append  them 
- * to the vector.
+ * This is a helper function that will find the header of a genome in a BGZF 
+ * file, which is the line before its first base.  It inflates further and 
+ * further back until it finds the start of the line.
  *
- * @param indicies The vector that contains all of the indicies of 
- *                 beginning/ending of each genome.
- * @param start The beginning index of the file for this thread to begin at.
- * @param end The ending indes of the file for this thread to end at.
- * @param mem The char array that holds the contents of the FASTA file.
+ * @param mem The mmaped BGZF file.
+ * @param size The size of the file.
+ * @param gzi The index of the file.
+ * @param entry The .fai line of the genome.
+ * @param desc The string to put the description in.
+ * @returns False if there is no header there with the genome's whole name.
  */
-void processChunks(BigIVec& indicies, BigInt start, BigInt end, const char* mem) {
-    for (BigInt i = start; i < end; i++) {
-        if (mem[i] == '>') {
-            {  // Critical section
-            std::lock_guard<std::mutex> lock(mute);
-            indicies.push_back(i);
-            }
+bool findHeader(const unsigned char* mem, BigInt size, const GziIndex& gzi, 
+                const FaiEntry& entry, std::string& desc) {
+    std::string text;
+    for (BigInt span = 256; ; span *= 4) {
+        BigInt from = (entry.offset > span) ? entry.offset - span : 0;
+        if (!inflateRange(mem, size, gzi, from, entry.offset, text) || 
+            text.size() < 2 || text.size() != entry.offset - from || 
+            text.back() != '\n') {
+            return false;
+        }
+        size_t nl = text.rfind('\n', text.size() - 2);
+        if (nl != std::string::npos || from == 0) {
+            BigInt start = (nl == std::string::npos) ? 0 : nl + 1;
+            desc = text.substr(start, text.size() - 1 - start);
+            break;
         }
     }
-}  // End of the 'getIndicies' function
+    return desc.size() > entry.name.size() && desc[0] == '>' && 
+           desc.compare(1, entry.name.size(), entry.name) == 0 && 
+           (desc.size() == entry.name.size() + 1 || 
+            isspace(static_cast<unsigned char>(desc[entry.name.size() + 1])));
+}  // End of the 'findHeader' function
 
 /**
- * This is a helper method to get all the start end endpoints of each 
- * genome in the file.
+ * This is the function that will count the genomes of a BGZF file through 
+ * its .fai and .gzi, inflating only the members that cover each genome asked 
+ * for.  Each genome is split into pieces like an mmaped one, and every piece 
+ * inflates its own members, so the pool shares the inflating too.
  *
- * @param mem The FASTA file.
+ * @param mem The mmaped BGZF file.
  * @param size The size of the file.
- *
- * @returns A vector that contains all of the indicies.
+ * @param gzi The index of the file.
+ * @param entries The .fai lines of the file.
+ * @param file The index of the file in the list of inputs.
+ * @returns False if the indexes don't match the file.
  */
-void getIndicies(BigIVec& indicies, const char* mem, BigInt size) {
-    // Create a vector to hold the threads
-    ThrdVec threads;
-    // Find out the size of the chunk of the file each thread gets
-    BigInt chunkSize = size / numThreads;
+bool readIndexedBgzf(const char* mem, BigInt size, const GziIndex& gzi, 
+                     const std::vector<FaiEntry>& entries, BigInt file) {
+    std::cout << "Counting nucleotides through the index...\n";
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(mem);
+    std::atomic<bool> error{false};
+    TaskGroup group;
+    for (auto& entry : entries) {
+        if (!wantRecord(">" + entry.name)) {
+            continue;
+        }
+        auto record = std::make_shared<StreamRecord>();
+        record->seq = writer->reserve();
+        record->file = file;
+        const FaiEntry* ep = &entry;
 
-    // Launch threads to process chunks of the file
-    for (int chunk = 0; chunk < numThreads; chunk++) {
-        BigInt start = chunk * chunkSize;
-        BigInt end   = (chunk == (numThreads -1)) ? size : (start + chunkSize);
-        threads.push_back(std::thread(processChunks, std::ref(indicies), 
-                    start, end, mem));
+        // The header is read by a task too, since it is a member away
+        record->pending++;
+        pool->submit(group, [record, bytes, size, &gzi, ep, &error] {
+            if (!findHeader(bytes, size, gzi, *ep, record->desc)) {
+                error = true;
+            }
+            record->start = ep->offset - record->desc.size() - 1;
+            releaseStreamRecord(*record);
+        });
+
+        // The last line's ending isn't part of the genome, so the file may 
+        // end one byte short of the bytes worked out from the .fai.  Each 
+        // piece inflates a '\r\n' and a base past its end, for the 
+        // dinucleotide that starts at its last base.
+        BigInt seqEnd = entry.offset + indexedBytes(entry);
+        for (BigInt start = entry.offset; start < seqEnd; start += pieceSize) {
+            BigInt end = std::min(seqEnd, start + pieceSize);
+            BigInt limit = std::min(seqEnd, end + 3);
+            record->pending++;
+            pool->submit(group, [record, bytes, size, &gzi, ep, start, end, 
+                                 limit, seqEnd, &error] {
+                thread_local std::string text;
+                if (!inflateRange(bytes, size, gzi, start, limit, text) || 
+                    (text.size() != limit - start && 
+                     !(limit == seqEnd && text.size() + 1 == limit - start))) {
+                    error = true;
+                }
+                Counts counts;
+                collectCounts(ep->name, 0, std::min<BigInt>(text.size(), 
+                              end - start), text.size(), text.data(), counts);
+                {  // Critical section
+                std::lock_guard<std::mutex> lock(record->lock);
+                record->counts += counts;
+                }
+                releaseStreamRecord(*record);
+            });
+        }
+        releaseStreamRecord(*record);
     }
+    pool->wait(group);
+    std::cout << "Done counting nucleotides...\n";
+    return !error;
+}  // End of the 'readIndexedBgzf' function
 
-    // Block until all the threads are finished
-    for (auto& t : threads) {
-        t.join();
+/**
+ * This is the function that will mmap a file and give the kernel the access 
+ * hints picked with --advise and --huge-pages.  It exits if the mmap fails.
+ *
+ * @param fd The file descriptor of the file.
+ * @param size The size of the file.
+ * @returns The start of the mapping.
+ */
+const char* mapFile(int fd, BigInt size) {
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (adviceName == "populate") {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void* mem = mmap(NULL, size, PROT_READ, flags, fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "mmap failed" << std::endl;
+        exit(-1);
+    }
+    if (adviceName == "sequential") {
+        madvise(mem, size, MADV_SEQUENTIAL);
+    } else if (adviceName == "willneed") {
+        madvise(mem, size, MADV_WILLNEED);
+    } else if (adviceName == "prefetch") {
+        // The workers ask for what they need as they go
+        madvise(mem, size, MADV_RANDOM);
     }
+#ifdef MADV_HUGEPAGE
+    if (hugePages) {
+        madvise(mem, size, MADV_HUGEPAGE);
+    }
+#endif
+    return static_cast<const char*>(mem);
+}  // End of the 'mapFile' function
 
-    threads.clear();
-    
-    // Include the end of the file
-    indicies.push_back(size);
+/**
+ * @returns True if a mode that walks the mmaped genomes was asked for.
+ */
+bool mmapOnly() {
+    return !gcTrack.empty() || kmerSize > 0 || findGaps || softMask;
+}  // End of the 'mmapOnly' function
 
-    // Sort the indicies in ascending order 
-    std::sort(indicies.begin(), indicies.end(), [](BigInt a, BigInt b)
-            {return a < b;});
+/**
+ * This is a helper function that will stop the program when a GC track, 
+ * k-mers, gaps or soft-masked runs are asked for from a file that isn't 
+ * mmaped.
+ *
+ * @param file The path to the file.
+ */
+void needsMmap(const std::string& file) {
+    std::cerr << "GC tracks, k-mers, gaps and soft-masked runs are only "
+                 "found in uncompressed FASTA files that are mmaped: " 
+              << file << std::endl;
+    exit(-1);
+}  // End of the 'needsMmap' function
 
-//    // TMP
-//    for (auto i : indicies) {
-//        std::cout << i << '\n';
-//    }
-}  // End of the 'getIndicies' function
+/**
+ * This is the function that will count a FASTA file from its .2bit cache, if 
+ * the cache's .idx says it is still good and every genome in it matches.
+ *
+ * @param file The path to the FASTA file.
+ * @param fd The FASTA file.
+ * @param sb The stats of the FASTA file.
+ * @param fileIndex The index of the file in the list of inputs.
+ * @returns False if there is no cache to use, so the FASTA file is read.
+ */
+bool readPackCache(const std::string& file, int fd, const struct stat& sb, 
+                   BigInt fileIndex) {
+    std::string cachePath = file + ".2bit";
+    int cfd = open(cachePath.c_str(), O_RDONLY);
+    if (cfd < 0) {
+        return false;
+    }
+    struct stat cb;
+    std::vector<PackSource> sources;
+    if (fstat(cfd, &cb) != 0 || cb.st_size < 16 || 
+        !readPackIndex(cachePath + ".idx", fd, sb, cb, sources)) {
+        close(cfd);
+        return false;
+    }
+    std::cout << "Using packed cache " << cachePath << std::endl;
+    const char* mem = mapFile(cfd, cb.st_size);
+    bool counted = readTwoBit(mem, cb.st_size, fileIndex, &sources);
+    munmap(const_cast<char*>(mem), cb.st_size);
+    close(cfd);
+    if (!counted) {
+        std::cout << cachePath << " doesn't match " << file 
+                  << ", reading it instead" << std::endl;
+    }
+    return counted;
+}  // End of the 'readPackCache' function
 
 /**
- * This is the function that will open the file.  Then it will get the size of 
- * the file and put it on the heap as a char array.  Then it will grab the 
- * description from the file.  And then invoke the function that will get the 
- * counts for the nucleotides.
+ * This is the function that will open the file.  Then it will get the size of
+ * the file and put it on the heap as a char array.  Then it will grab the
+ * description from the file.  And then invoke the function that will get the
+ * counts for the nucleotides.  Stdin ("-"), pipes and anything else that
+ * isn't a regular file are streamed instead, as are gzip and BGZF files. 
+ * A BGZF file with an up to date .fai and .gzi is read through them, and 
+ * they are written the first time it is streamed.  A GC track, k-mers, gaps 
+ * and soft-masked runs are only found in an mmaped file.
+ * With --io=direct or --mem-limit the file is read a block at a time.  A 
+ * .2bit file, or the .2bit cache of a FASTA file with --pack, is counted 
+ * from its packed bases.
+ * Those are done by the time it returns.  An mmaped file is handed back 
+ * while its genomes are still being counted, to be finished by 'finishFile'.
  *
  * @param file The path to the fasta file.
+ * @param fileIndex The index of the file in the list of inputs.
+ * @returns The file being counted, or NULL if it is done already.
  */
-void readFile(std::string file) {
+std::unique_ptr<OpenFile> readFile(std::string file, BigInt fileIndex) {
     // Declaring for the file and file descriptor
     const char* mem;
     int fd;
@@ -277,52 +5064,495 @@ void readFile(std::string file) {
     struct stat sb;
 
     // Open the file and get the stats
-    fd = open(file.c_str(), O_RDONLY);
-    fstat(fd, &sb);
-
-    // MMap the file and make sure it was successful
-    mem = static_cast<char*>(mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
-    if (mem == MAP_FAILED) {
-        std::cerr << "mmap failed" << std::endl;
+    fd = (file == "-") ? STDIN_FILENO : open(file.c_str(), O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        std::cerr << "Could not open " << file << std::endl;
         exit(-1);
     }
-    
-    std::cout << "Pre-processing..." << std::endl;
+    // A GC track, k-mers or runs need the whole genome mapped to walk it in 
+    // pieces
+    if (mmapOnly() && (!S_ISREG(sb.st_mode) || forceStream || 
+                             ioEngine != "mmap" || memLimit > 0)) {
+        needsMmap(file);
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        StreamReader reader(fd, blockSize);
+        streamFile(reader, fileIndex, NULL);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    // A .2bit file, or an up to date .2bit cache of a FASTA file, is counted 
+    // from its packed bases
+    unsigned char head[18];
+    ssize_t headLen = pread(fd, head, sizeof(head), 0);
+    uint32_t signature = 0;
+    if (headLen >= 4) {
+        memcpy(&signature, head, 4);
+    }
+    if (signature == TWOBIT_SIGNATURE || 
+        signature == __builtin_bswap32(TWOBIT_SIGNATURE)) {
+        if (mmapOnly()) {
+            needsMmap(file);
+        }
+        mem = mapFile(fd, sb.st_size);
+        if (!readTwoBit(mem, sb.st_size, fileIndex, NULL)) {
+            std::cerr << "Malformed .2bit file: " << file << std::endl;
+            exit(-1);
+        }
+        munmap(const_cast<char*>(mem), sb.st_size);
+        close(fd);
+        return nullptr;
+    }
+    if (usePack && !mmapOnly() && readPackCache(file, fd, sb, fileIndex)) {
+        close(fd);
+        return nullptr;
+    }
+
+    // Compressed files are inflated a block at a time, in parallel for BGZF
+    bool gzip = headLen >= 2 && head[0] == 0x1f && head[1] == 0x8b;
+    if (forceStream || gzip) {
+        if (mmapOnly()) {
+            needsMmap(file);
+        }
+        if (gzip && BgzfReader::isBgzf(head, headLen)) {
+            mem = mapFile(fd, sb.st_size);
+            std::string faiPath = file + ".fai", gziPath = file + ".gzi";
+            std::vector<FaiEntry> entries;
+            GziIndex gzi;
+            if (useIndex && parseIndex(faiPath, sb, entries) && 
+                readGzi(gziPath, sb, gzi)) {
+                // Only the members under the genomes asked for are inflated
+                std::cout << "Using index " << faiPath << " and " << gziPath 
+                          << std::endl;
+                if (!readIndexedBgzf(mem, sb.st_size, gzi, entries, 
+                                     fileIndex)) {
+                    std::cerr << faiPath << " or " << gziPath 
+                              << " doesn't match " << file 
+                              << ", remove them or use --no-index" << std::endl;
+                    exit(-1);
+                }
+            } else {
+                // Inflate all of it, building both indexes along the way
+                std::cout << "Inflating BGZF blocks in parallel..." 
+                          << std::endl;
+                BgzfReader reader(mem, sb.st_size, blockSize);
+                std::vector<FaiEntry> index;
+                streamFile(reader, fileIndex, useIndex ? &index : NULL);
+                if (useIndex) {
+                    writeIndex(faiPath, index);
+                    writeGzi(gziPath, reader.index());
+                }
+            }
+            munmap(const_cast<char*>(mem), sb.st_size);
+        } else {
+            StreamReader reader(fd, blockSize);
+            streamFile(reader, fileIndex, NULL);
+        }
+        close(fd);
+        return nullptr;
+    }
+
+    // Direct I/O reads the file into aligned buffers, without the page cache
+    if (ioEngine == "direct") {
+        int dfd = open(file.c_str(), O_RDONLY | O_DIRECT);
+        if (dfd < 0) {
+            // Some file systems, like tmpfs, don't do O_DIRECT
+            std::cout << "O_DIRECT isn't supported here, using plain reads" 
+                      << std::endl;
+            dfd = fd;
+        }
+        BigInt align = DirectReader::DIRECT_ALIGN;
+        BigInt directSize = (blockSize + align - 1) / align * align;
+        std::cout << "Reading with direct I/O..." << std::endl;
+        {
+            DirectReader reader(dfd, sb.st_size, directSize);
+            streamFile(reader, fileIndex, NULL);
+        }
+        if (dfd != fd) {
+            close(dfd);
+        }
+        close(fd);
+        return nullptr;
+    }
 
-    // Get all of the indicies of each  genome in the file
-    BigIVec indicies; 
-    getIndicies(indicies, mem, sb.st_size);
+    // With a memory limit the file is mapped a window at a time instead
+    if (memLimit > 0) {
+        BigInt page = sysconf(_SC_PAGESIZE);
+        BigInt windowSize = memLimit / BlockReader::STREAM_BUFFERS / page * page;
+        std::cout << "Mapping " << windowSize << " bytes at a time..." 
+                  << std::endl;
+        WindowReader reader(fd, sb.st_size, windowSize);
+        streamFile(reader, fileIndex, NULL);
+        close(fd);
+        return nullptr;
+    }
 
-    std::cout << "Done pre-processing..." << std::endl;
+    // There is nothing to count in an empty file, and it can't be mmaped
+    if (sb.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
 
-    // Stage the threads for nucleotide counting
-    stageCollections(indicies, mem, sb.st_size);
+    // MMap the file
+    std::unique_ptr<OpenFile> open(new OpenFile);
+    open->path = file;
+    open->fileIndex = fileIndex;
+    open->fd = fd;
+    open->size = sb.st_size;
+    open->stats = sb;
+    open->mem = mem = mapFile(fd, sb.st_size);
+    
+    // Get all of the indicies of each genome in the file, from the .fai if 
+    // there is an up to date one
+    open->faiPath = file + ".fai";
+    bool indexed = useIndex && readIndex(open->faiPath, sb, open->indicies, mem);
+    if (indexed) {
+        std::cout << "Using index " << open->faiPath << std::endl;
+    } else {
+        std::cout << "Pre-processing..." << std::endl;
+        getIndicies(open->indicies, mem, sb.st_size);
+        std::cout << "Done pre-processing..." << std::endl;
+    }
 
-    // Close the file
-    close(fd);
+    // Stage the threads for nucleotide counting, building the .fai lines 
+    // along the way if there wasn't an index.  The .fai and the .2bit cache 
+    // need every genome, so they are left for a run without --records.  A 
+    // GC track, k-mers, gaps or soft-masked runs are found instead of the 
+    // stats with --gc-track, --kmer, --gaps and --soft-mask.
+    bool whole = recordNames.empty() && !mmapOnly();
+    open->buildIndex = useIndex && !indexed && whole;
+    open->buildPack = usePack && whole;
+    if (!gcTrack.empty()) {
+        stageTrack(*open);
+    } else if (kmerSize > 0) {
+        stageKmers(*open);
+    } else if (findGaps || softMask) {
+        stageRuns(*open);
+    } else {
+        stageCollections(*open);
+    }
+    return open;
 }  // End of the 'readFile' function
 
+/**
+ * This is the function that will wait for an mmaped file to be counted.  Then 
+ * it will write the .fai if one was built, and the .2bit cache with --pack, 
+ * and unmap and close the file, 
+ * which the descriptions pointed into.
+ *
+ * @param file The file being counted.
+ */
+void finishFile(OpenFile& file) {
+    pool->wait(file.group);
+    std::cout << "Done counting nucleotides...\n";
+    if (file.buildIndex) {
+        writeIndex(file.faiPath, file.index);
+    }
+    if (file.buildPack) {
+        writeTwoBit(file.path + ".2bit", file.records, file.mem, file.stats);
+    }
+    munmap(const_cast<char*>(file.mem), file.size);
+    close(file.fd);
+}  // End of the 'finishFile' function
+
+/**
+ * This is the function that will count every file asked for, in order.  Up 
+ * to 'FILES_IN_FLIGHT' mmaped files are counted at once, so the pool is kept 
+ * busy while the next files are opened and scanned, and a run of small files 
+ * doesn't wait on the big one in front of it.  When there is more than one 
+ * file, each file's table is tagged with its path.  The other formats have 
+ * the path on every line.
+ *
+ * @param files The paths of the files.
+ */
+void readFiles(const std::vector<std::string>& files) {
+    const BigInt FILES_IN_FLIGHT = 8;
+    std::deque<std::unique_ptr<OpenFile>> counting;
+    if (!mmapOnly()) {
+        formatHeader();
+    }
+    for (BigInt f = 0; f < files.size(); f++) {
+        const std::string& file = files[f];
+        if (files.size() > 1) {
+            std::cout << "Reading " << file << std::endl;
+            if (outputFormat == "table" && !mmapOnly()) {
+                writer->put(writer->reserve(), "\nFile: " + file + "\n");
+            }
+        }
+        std::unique_ptr<OpenFile> open = readFile(file, f);
+        if (open) {
+            counting.push_back(std::move(open));
+        }
+        if (counting.size() > FILES_IN_FLIGHT) {
+            finishFile(*counting.front());
+            counting.pop_front();
+        }
+    }
+    for (auto& open : counting) {
+        finishFile(*open);
+    }
+    // The k-mers of every file go into one histogram
+    if (kmerSize > 0 && kmerSize <= 31) {
+        writeKmers<uint64_t>();
+    } else if (kmerSize > 31) {
+        writeKmers<unsigned __int128>();
+    }
+}  // End of the 'readFiles' function
+
+/**
+ * This is a helper function that will read the options out of the command 
+ * line and set the globals they control.
+ *
+ * @param argc The number of args.
+ * @param argv The args.
+ * @returns The positional args, in order.
+ */
+std::vector<std::string> parseArgs(int argc, char** argv) {
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--kernel=") == 0) {
+            kernelName = arg.substr(9);
+        } else if (arg == "--verify") {
+            verifyCounts = true;
+        } else if (arg.compare(0, 13, "--piece-size=") == 0) {
+            pieceSize = std::stoull(arg.substr(13));
+            if (pieceSize == 0) {
+                throw std::invalid_argument("--piece-size must be positive");
+            }
+        } else if (arg.compare(0, 9, "--window=") == 0) {
+            outputWindow = std::stoull(arg.substr(9));
+            if (outputWindow == 0) {
+                throw std::invalid_argument("--window must be positive");
+            }
+        } else if (arg == "--stream") {
+            forceStream = true;
+        } else if (arg.compare(0, 13, "--block-size=") == 0) {
+            blockSize = std::stoull(arg.substr(13));
+            if (blockSize == 0) {
+                throw std::invalid_argument("--block-size must be positive");
+            }
+        } else if (arg.compare(0, 9, "--advise=") == 0) {
+            adviceName = arg.substr(9);
+            if (adviceName != "normal" && adviceName != "sequential" && 
+                adviceName != "willneed" && adviceName != "prefetch" && 
+                adviceName != "populate") {
+                throw std::invalid_argument("Unknown advice: " + adviceName);
+            }
+            prefetch = (adviceName == "prefetch");
+        } else if (arg.compare(0, 12, "--mem-limit=") == 0) {
+            memLimit = std::stoull(arg.substr(12));
+            if (memLimit < BlockReader::STREAM_BUFFERS * 
+                           static_cast<BigInt>(sysconf(_SC_PAGESIZE))) {
+                throw std::invalid_argument("--mem-limit is too small");
+            }
+        } else if (arg.compare(0, 12, "--file-list=") == 0) {
+            fileList = arg.substr(12);
+        } else if (arg == "-o") {
+            if (++i == argc) {
+                throw std::invalid_argument("-o needs a path");
+            }
+            outputPath = argv[i];
+        } else if (arg.compare(0, 9, "--output=") == 0) {
+            outputPath = arg.substr(9);
+        } else if (arg.compare(0, 9, "--format=") == 0) {
+            outputFormat = arg.substr(9);
+            if (outputFormat != "table" && outputFormat != "tsv" && 
+                outputFormat != "jsonl" && outputFormat != "bin") {
+                throw std::invalid_argument("Unknown format: " + outputFormat);
+            }
+        } else if (arg.compare(0, 5, "--io=") == 0) {
+            ioEngine = arg.substr(5);
+            if (ioEngine != "mmap" && ioEngine != "direct") {
+                throw std::invalid_argument("Unknown I/O engine: " + ioEngine);
+            }
+        } else if (arg.compare(0, 10, "--records=") == 0) {
+            std::istringstream names(arg.substr(10));
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                if (!name.empty()) {
+                    recordNames.push_back(name);
+                }
+            }
+            if (recordNames.empty()) {
+                throw std::invalid_argument("--records needs a name");
+            }
+            std::sort(recordNames.begin(), recordNames.end());
+        } else if (arg.compare(0, 11, "--gc-track=") == 0) {
+            gcTrack = arg.substr(11);
+            if (gcTrack != "bedgraph" && gcTrack != "wig") {
+                throw std::invalid_argument("Unknown track: " + gcTrack);
+            }
+        } else if (arg.compare(0, 12, "--gc-window=") == 0) {
+            gcWindow = std::stoull(arg.substr(12));
+            if (gcWindow == 0) {
+                throw std::invalid_argument("--gc-window must be positive");
+            }
+        } else if (arg.compare(0, 10, "--gc-step=") == 0) {
+            gcStep = std::stoull(arg.substr(10));
+            if (gcStep == 0) {
+                throw std::invalid_argument("--gc-step must be positive");
+            }
+        } else if (arg.compare(0, 7, "--kmer=") == 0) {
+            kmerSize = std::stoi(arg.substr(7));
+            if (kmerSize < 1 || kmerSize > 63) {
+                throw std::invalid_argument("--kmer must be from 1 to 63");
+            }
+        } else if (arg == "--canonical") {
+            canonicalKmers = true;
+        } else if (arg.compare(0, 12, "--kmer-dump=") == 0) {
+            kmerDump = arg.substr(12);
+        } else if (arg == "--gaps") {
+            findGaps = true;
+        } else if (arg.compare(0, 10, "--min-gap=") == 0) {
+            minGap = std::stoull(arg.substr(10));
+            if (minGap == 0) {
+                throw std::invalid_argument("--min-gap must be positive");
+            }
+        } else if (arg == "--soft-mask") {
+            softMask = true;
+        } else if (arg == "--dinucleotides") {
+            countPairs = true;
+        } else if (arg == "--pack") {
+            usePack = true;
+        } else if (arg == "--huge-pages") {
+            hugePages = true;
+        } else if (arg == "--no-index") {
+            useIndex = false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            throw std::invalid_argument("Unknown option: " + arg);
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (gcStep == 0) {
+        gcStep = gcWindow;
+    }
+    if ((canonicalKmers || !kmerDump.empty()) && kmerSize == 0) {
+        throw std::invalid_argument("--canonical and --kmer-dump need --kmer");
+    }
+    if ((kmerSize > 0) + !gcTrack.empty() + findGaps + softMask > 1) {
+        throw std::invalid_argument("--kmer, --gc-track, --gaps and "
+                                    "--soft-mask can't be mixed");
+    }
+    if (minGap != 1 && !findGaps) {
+        throw std::invalid_argument("--min-gap needs --gaps");
+    }
+    // The stream buffers count against the memory limit too
+    if (memLimit > 0) {
+        blockSize = std::min(blockSize, memLimit / BlockReader::STREAM_BUFFERS);
+    }
+    return args;
+}  // End of the 'parseArgs' function
+
+/**
+ * This is a helper function that will add a path to the list of files to 
+ * read.  A directory adds every regular file under it, in sorted order, 
+ * leaving out the .fai and .gzi indexes, and the .2bit caches with --pack.
+ *
+ * @param path The path the user gave.
+ * @param files The list of files to add to.
+ */
+void addPath(const std::string& path, std::vector<std::string>& files) {
+    namespace fs = std::filesystem;
+    if (path == "-" || !fs::is_directory(path)) {
+        files.push_back(path);
+        return;
+    }
+    std::vector<std::string> found;
+    for (auto& entry : fs::recursive_directory_iterator(path)) {
+        std::string ext = entry.path().extension().string();
+        if (entry.is_regular_file() && ext != ".fai" && ext != ".gzi" && 
+            !(usePack && ext == ".2bit")) {
+            found.push_back(entry.path().string());
+        }
+    }
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}  // End of the 'addPath' function
+
 /**
  * The main function.
  */
 int main (int argc, char** argv) {
+    // Split the options from the positional args
+    std::vector<std::string> args;
+    try {
+        args = parseArgs(argc, argv);
+    } catch (std::exception& e) {
+        usage();
+        std::cerr << e.what() << std::endl;
+        return 0;
+    }
+    // When the stats go to stdout, the progress goes to stderr instead
+    if (outputPath == "-") {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
     // Make sure that the user enter the right number of args
-    if (argc != 3) {
+    if (args.size() < (fileList.empty() ? 2 : 1)) {
         // Prompt the usage
         usage();
     } else {
-        // Get the file path supplied by the user
-        std::string filePath;
-        filePath = argv[1];
         try {
+            // Get the file paths supplied by the user
+            std::vector<std::string> files;
+            for (BigInt i = 0; i < args.size() - 1; i++) {
+                addPath(args[i], files);
+            }
+            if (!fileList.empty()) {
+                std::ifstream list(fileList);
+                if (!list) {
+                    throw std::runtime_error("Could not open " + fileList);
+                }
+                std::string line;
+                while (std::getline(list, line)) {
+                    if (!line.empty()) {
+                        addPath(line, files);
+                    }
+                }
+            }
             // Get the number of threads to use
-            numThreads = std::stoi(argv[2]);
+            numThreads = std::stoi(args.back());
+            if (numThreads < 1) {
+                throw std::invalid_argument("NUM_THREADS must be positive");
+            }
+            // Start the thread pool shared by every stage
+            ThreadPool threadPool(numThreads);
+            pool = &threadPool;
+            // Pick the counting kernel for this CPU
+            std::string kernel = selectKernel(kernelName);
+            std::cout << "Using the " << kernel << " counting kernel..." 
+                      << std::endl;
             // Open a file to put the output in
-            ofile.open("out.txt", std::ios::out);
-            // Invoke the function that will read the file
-            readFile(filePath);
-            std::cout << "Output is stored in file named out.txt" << std::endl;
-            ofile.close();
+            int ofd = STDOUT_FILENO;
+            if (outputPath != "-") {
+                ofd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 
+                           0644);
+                if (ofd < 0) {
+                    throw std::runtime_error("Could not open " + outputPath);
+                }
+            }
+            OutputThread output(ofd);
+            OrderedWriter orderedWriter(output, outputWindow);
+            writer = &orderedWriter;
+            // Invoke the function that will read the files
+            inputPaths = files;
+            readFiles(files);
+            orderedWriter.flush();
+            bool written = output.finish();
+            if (ofd != STDOUT_FILENO) {
+                written = (close(ofd) == 0) && written;
+            }
+            if (!written) {
+                throw std::runtime_error("Could not write " + outputPath);
+            }
+            if (outputPath != "-") {
+                std::cout << "Output is stored in file named " << outputPath 
+                          << std::endl;
+            }
         } catch (std::exception& e) {
             // If things go wrong, prompt the usage 
             usage();